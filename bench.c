@@ -0,0 +1,125 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#include "bench.h"
+
+#if ENABLE_BENCH
+
+#include "buckets.h"
+#include "hx711.h"
+#include "stepper.h"
+#include "timer.h"
+#include "twi.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+/// Raw HX711 result around which inputs vary.
+#define BENCH_RAW 0x123456UL
+/// Samples added to buckets before timing starts.
+#define BENCH_FILL 16
+
+typedef void (*bench_fn)(uint8_t i);
+
+/// Keeps results of kernels alive.
+static volatile uint32_t bench_sink;
+
+/// Deterministic noise of a few LSB similar to HX711 readings.
+static uint32_t bench_input(uint8_t i) {
+    return BENCH_RAW + (uint8_t)(i * 37) % 16;
+}
+
+static void bench_none(uint8_t i) {}
+
+static void bench_buckets_add(uint8_t i) {
+    buckets_add(bench_input(i));
+}
+
+static void bench_buckets_filter(uint8_t i) {
+    bench_sink = buckets_filter().sum;
+}
+
+static void bench_weight(uint8_t i) {
+    bench_sink = calculate_weight(bench_input(i));
+}
+
+static void bench_stepper_period(uint8_t i) {
+    bench_sink = stepper_bench_period((uint16_t)i << 8);
+}
+
+static void bench_crc(uint8_t i) {
+    bench_sink = twi_bench_crc(bench_sink, i);
+}
+
+static const __flash bench_fn kernels[TWI_BENCH_COUNT] = {
+    [TWI_BENCH_NONE] = bench_none,
+    [TWI_BENCH_BUCKETS_ADD] = bench_buckets_add,
+    [TWI_BENCH_BUCKETS_FILTER] = bench_buckets_filter,
+    [TWI_BENCH_WEIGHT] = bench_weight,
+    [TWI_BENCH_STEPPER_PERIOD] = bench_stepper_period,
+    [TWI_BENCH_CRC] = bench_crc,
+};
+
+/// Time single call of kernel in CPU cycles including overhead.
+static uint16_t time_call(bench_fn fn, uint8_t i) {
+    cli();
+    uint16_t start = TCB0.CNT;
+    fn(i);
+    uint16_t cycles = TCB0.CNT - start;
+    sei();
+    return cycles;
+}
+
+bool bench_run(uint8_t kernel, uint8_t count, uint8_t *dst) {
+    if (kernel >= TWI_BENCH_COUNT || !timer_cycles_start_cpu()) {
+        for (uint8_t i = 0; i < BENCH_RESULT_SIZE; ++i) {
+            dst[i] = 0xFF;
+        }
+        return false;
+    }
+    bench_fn fn = kernels[kernel];
+
+    buckets_reset();
+    for (uint8_t i = 0; i < BENCH_FILL; ++i) {
+        buckets_add(bench_input(i));
+    }
+
+    uint16_t overhead = 0xFFFF;
+    for (uint8_t i = 0; i < 4; ++i) {
+        uint16_t c = time_call(bench_none, i);
+        if (c < overhead) {
+            overhead = c;
+        }
+    }
+
+    uint16_t min = 0xFFFF;
+    uint16_t max = 0;
+    uint32_t sum = 0;
+    uint8_t i = 0;
+    do {
+        uint16_t c = time_call(fn, i);
+        c = c > overhead ? c - overhead : 0;
+        if (c < min) {
+            min = c;
+        }
+        if (c > max) {
+            max = c;
+        }
+        sum += c;
+    } while (++i != count);
+    timer_cycles_stop();
+    buckets_reset();
+
+    uint16_t avg = sum / (i == 0 ? 256U : i);
+    dst[0] = min >> 8;
+    dst[1] = min & 0xff;
+    dst[2] = avg >> 8;
+    dst[3] = avg & 0xff;
+    dst[4] = max >> 8;
+    dst[5] = max & 0xff;
+    return true;
+}
+
+#endif
@@ -0,0 +1,27 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Size of result of benchmark.
+#define BENCH_RESULT_SIZE 6
+
+/**
+ * @brief Time kernel with TCB0 as cycle counter.
+ *
+ * Each call is timed separately with interrupts disabled and the overhead
+ * of an empty call is subtracted. Buckets are reset before and after.
+ * Result is minimum, average and maximum of cycles per call, all big endian
+ * 16 bit.
+ *
+ * @param kernel Kernel TWI_BENCH_*
+ * @param count Number of calls, 0 is 256
+ * @param dst Result of BENCH_RESULT_SIZE bytes, all 0xFF on failure
+ * @return false iff kernel is unknown or TCB0 is in use.
+ */
+bool bench_run(uint8_t kernel, uint8_t count, uint8_t *dst);
@@ -3,16 +3,36 @@
     SPDX-License-Identifier: MIT
 */
 
+#define LOG_MODULE LOG_MOD_BUCKETS
+
 #include "buckets.h"
 
 #include "debug.h"
 
 #include <string.h>
 
-#define BUCKET_COUNT 8
-
+/// 12 buckets of 3 bytes stay below the 40 bytes of the former 8 buckets
+/// with 32 bit sums.
+#define BUCKET_COUNT 12
+/// Resolution of position of values within their bucket in bits
+#define FRAC_BITS 8
+
+_Static_assert((BUCKET_COUNT & 1) == 0 &&
+                   BUCKET_COUNT <= (1 << BUCKETS_SPAN_BITS),
+               "Bucket count must be even and fit into span");
+
+/**
+ * Values are not accumulated absolutely but as sum of their positions
+ * within their bucket in units of 1/2^FRAC_BITS of the bucket width. As a
+ * bucket can hold at most 255 values, the sum fits into 16 bits.
+ *
+ * Sums are exact while shift <= FRAC_BITS, i.e. while all values lie
+ * within BUCKET_COUNT << FRAC_BITS. Above, positions are rounded down to
+ * 2^(shift - FRAC_BITS) and the filter adds half of that per value, which
+ * keeps the mean unbiased but not exact.
+ */
 struct {
-    uint32_t accu[BUCKET_COUNT];
+    uint16_t frac[BUCKET_COUNT];
     uint8_t count[BUCKET_COUNT];
     uint32_t base;
     uint8_t shift;
@@ -26,7 +46,7 @@ void buckets_init(uint8_t min_shift) {
 }
 
 void buckets_reset(void) {
-    memset(buckets.accu, 0, sizeof(buckets.accu));
+    memset(buckets.frac, 0, sizeof(buckets.frac));
     memset(buckets.count, 0, sizeof(buckets.count));
     buckets.shift = 0;
     buckets.lower = 0;
@@ -37,8 +57,20 @@ bool buckets_empty(void) {
     return buckets.upper == 0;
 }
 
+/// Move bucket into lower or upper half of bucket of double width.
+static void buckets_move(int8_t dst, int8_t src, bool upper) {
+    uint32_t f = buckets.frac[src];
+    if (upper) {
+        f += (uint32_t)buckets.count[src] << FRAC_BITS;
+    }
+    buckets.frac[dst] = f >> 1;
+    buckets.count[dst] = buckets.count[src];
+}
+
 static void buckets_merge(int8_t dst, int8_t src0) {
-    buckets.accu[dst] = buckets.accu[src0] + buckets.accu[src0 + 1];
+    uint32_t f = (uint32_t)buckets.frac[src0] + buckets.frac[src0 + 1] +
+                 ((uint32_t)buckets.count[src0 + 1] << FRAC_BITS);
+    buckets.frac[dst] = f >> 1;
     buckets.count[dst] = buckets.count[src0] + buckets.count[src0 + 1];
 }
 
@@ -49,9 +81,7 @@ void buckets_deflate(void) {
 
     if ((buckets.upper & 0x1) != 0) {
         int8_t i = buckets.upper - 1;
-        int8_t j = i >> 1;
-        buckets.accu[j] = buckets.accu[i];
-        buckets.count[j] = buckets.count[i];
+        buckets_move(i >> 1, i, false);
     }
 
     for (int8_t i = BUCKET_COUNT - 1, j = i; i - 1 >= buckets.lower;
@@ -61,15 +91,13 @@ void buckets_deflate(void) {
 
     if ((buckets.lower & 0x1) != 0) {
         int8_t i = buckets.lower;
-        int8_t j = (BUCKET_COUNT + i) >> 1;
-        buckets.accu[j] = buckets.accu[i];
-        buckets.count[j] = buckets.count[i];
+        buckets_move((BUCKET_COUNT + i) >> 1, i, true);
     }
 
     ++buckets.shift;
     int8_t i = (buckets.upper + 1) >> 1;
     int8_t j = (BUCKET_COUNT + buckets.lower) >> 1;
-    memset(buckets.accu + i, 0, sizeof(buckets.accu[0]) * (j - i));
+    memset(buckets.frac + i, 0, sizeof(buckets.frac[0]) * (j - i));
     memset(buckets.count + i, 0, sizeof(buckets.count[0]) * (j - i));
     buckets.upper = i;
     buckets.lower = j;
@@ -83,16 +111,25 @@ void buckets_add(uint32_t val) {
         buckets.lower = BUCKET_COUNT;
     }
 
-    int8_t i;
+    int32_t d = (int32_t)val - (int32_t)buckets.base;
+    int32_t k;
     for (;;) {
-        i = ((int32_t)val - (int32_t)buckets.base) >> buckets.shift;
-        if ((i < 0 && i + BUCKET_COUNT >= buckets.upper) ||
-            (i >= 0 && i < buckets.lower)) {
+        k = d >> buckets.shift;
+        if ((k < 0 && k + BUCKET_COUNT >= buckets.upper) ||
+            (k >= 0 && k < buckets.lower)) {
             break;
         }
         buckets_deflate();
     };
 
+    uint32_t pos = (uint32_t)d & ((1UL << buckets.shift) - 1);
+    if (buckets.shift <= FRAC_BITS) {
+        pos <<= FRAC_BITS - buckets.shift;
+    } else {
+        pos >>= buckets.shift - FRAC_BITS;
+    }
+
+    int8_t i = k;
     if (i < 0) {
         i += BUCKET_COUNT;
         if (i < buckets.lower) {
@@ -102,7 +139,7 @@ void buckets_add(uint32_t val) {
         buckets.upper = i + 1;
     }
 
-    buckets.accu[i] += val;
+    buckets.frac[i] += pos;
     ++buckets.count[i];
 }
 
@@ -134,6 +171,11 @@ static uint8_t buckets_end(uint8_t thresh) {
     return end;
 }
 
+/// Get index of bucket relative to base.
+static int8_t buckets_index(uint8_t i) {
+    return i < buckets.upper ? (int8_t)i : (int8_t)i - BUCKET_COUNT;
+}
+
 accu_t buckets_filter(void) {
     uint8_t total = 0;
     for (uint8_t i = 0; i < BUCKET_COUNT; ++i) {
@@ -150,26 +192,48 @@ accu_t buckets_filter(void) {
         .total = total,
         .span = end - start - 1,
     };
+    // sum of bucket indices and of positions within buckets
+    int16_t index = 0;
+    uint32_t frac = 0;
     uint8_t i = start;
     if (end <= start) {
         for (; i < BUCKET_COUNT; ++i) {
             res.count += buckets.count[i];
-            res.sum += buckets.accu[i];
+            index += (int16_t)buckets.count[i] * buckets_index(i);
+            frac += buckets.frac[i];
         }
         i = 0;
         res.span += BUCKET_COUNT;
     }
 
-    res.span |= buckets.shift << 3;
+    uint8_t shift = buckets.shift;
+    res.span |= (shift < (1 << (8 - BUCKETS_SPAN_BITS))
+                     ? shift
+                     : (1 << (8 - BUCKETS_SPAN_BITS)) - 1)
+                << BUCKETS_SPAN_BITS;
 
     for (; i < end; ++i) {
         res.count += buckets.count[i];
-        res.sum += buckets.accu[i];
+        index += (int16_t)buckets.count[i] * buckets_index(i);
+        frac += buckets.frac[i];
     }
+
+    if (shift <= FRAC_BITS) {
+        frac >>= FRAC_BITS - shift;
+    } else {
+        // add half of the truncated resolution for each value
+        frac = (frac << (shift - FRAC_BITS)) +
+               ((uint32_t)res.count << (shift - FRAC_BITS - 1));
+    }
+    res.sum = buckets.base * res.count + ((uint32_t)(int32_t)index << shift) +
+              frac;
     return res;
 }
 
 void buckets_dump(void) {
+    if (!LOG_ON(LOG_DEBUG)) {
+        return;
+    }
     LOGC('[');
     LOGDEC(buckets.upper);
     LOGS(", ");
@@ -183,7 +247,7 @@ void buckets_dump(void) {
     for (int8_t i = 0; i < BUCKET_COUNT; ++i) {
         LOGDEC(buckets.count[i]);
         LOGS(", ");
-        LOGDEC_U32(buckets.accu[i]);
+        LOGDEC_U16(buckets.frac[i]);
         LOGNL();
     }
 }
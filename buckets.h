@@ -8,10 +8,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/// Bits of accu.span holding the number of buckets spanned minus one.
+#define BUCKETS_SPAN_BITS 4
+
 typedef struct accu {
+    /// Sum of accepted values
     uint32_t sum;
+    /// Number of accepted values
     uint8_t count;
+    /// Number of all values
     uint8_t total;
+    /// Shift of bucket width in upper bits, span in BUCKETS_SPAN_BITS
     uint8_t span;
 } accu_t;
 
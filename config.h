@@ -32,16 +32,42 @@
 #define STP_STEP_PORT PORTA
 #define STP_STEP_BIT  (1 << 5)
 
+// Homing sensor, active low, on otherwise unused MOSI pin
+#define HOME_PORT    PORTA
+#define HOME_BIT     (1 << 1)
+#define HOME_PINCTRL (HOME_PORT.PIN1CTRL)
+
+// HX711 RATE select on RXD pin, high for 80 SPS and low for 10 SPS
+#define RATE_PORT PORTB
+#define RATE_BIT  (1 << 3)
+
+#if ENABLE_HX711_RATE && !defined(NO_SERIAL)
+#error "ENABLE_HX711_RATE needs RXD pin and requires NO_SERIAL"
+#endif
+
+// External trigger input on TXD pin
+#define TRIG_PORT      PORTB
+#define TRIG_BIT       (1 << 2)
+#define TRIG_PINCTRL   (TRIG_PORT.PIN2CTRL)
+#define TRIG_PORT_VECT PORTB_PORT_vect
+
+#if ENABLE_TRIGGER && !defined(NO_SERIAL)
+#error "ENABLE_TRIGGER needs TXD pin and requires NO_SERIAL"
+#endif
+
 // #define UPDI     PA0
 // #define SDA      PB1
 // #define SCL      PB0
 // #define MOSI     PA1
+// #define HOME     PA1
 // #define MISO     PA2
 // #define SCK      PA3
 // #define LED      PA5
 // #define VALVE    PA6
 // #define RXD      PB3
+// #define RATE     PB3
 // #define TXD      PB2
+// #define TRIG     PB2
 // #define STP_NSLP PA7
 // #define STP_DIR  PA4
 // #define STP_STEP PA5
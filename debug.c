@@ -142,7 +142,7 @@ static inline void dbg_push_tail(uint8_t tail) {
     sei();
 }
 
-void debug_putchar(char c) {
+static void serial_putchar(char c) {
     uint8_t newtail = (serial.send.tail + 1) % TX_BUFFER_SIZE;
     if (newtail == serial.send.head) {
         dbg_wait_tx(newtail);
@@ -152,6 +152,127 @@ void debug_putchar(char c) {
     dbg_push_tail(newtail);
 }
 
+void debug_write(const char *str, uint8_t len) {
+    while (len > 0) {
+        uint8_t n = (serial.send.head + TX_BUFFER_SIZE - serial.send.tail - 1) %
+                    TX_BUFFER_SIZE;
+        if (n == 0) {
+            dbg_wait_tx((serial.send.tail + 1) % TX_BUFFER_SIZE);
+            continue;
+        }
+
+        if (n > len) {
+            n = len;
+        }
+
+        if (serial.send.tail + n >= TX_BUFFER_SIZE) {
+            uint8_t c = TX_BUFFER_SIZE - serial.send.tail;
+            memcpy(serial.send.buf + serial.send.tail, str, c);
+            str += c;
+            len -= c;
+            n -= c;
+            serial.send.tail = 0;
+        }
+
+        memcpy(serial.send.buf, str, n);
+        dbg_push_tail(serial.send.tail + n);
+
+        str += n;
+        len -= n;
+    }
+}
+
+void debug_finish(void) {
+    cli();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (!serial.tx_complete) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    sei();
+}
+
+void debug_stop(void) {
+    debug_finish();
+    // disable all interrupts
+    USART0.CTRLA = 0;
+    // From errata:
+    // Make sure the receiver is enabled while disabling the transmitter.
+    USART0.CTRLB = USART_RXEN_bm;
+    USART0.CTRLB = 0;
+}
+
+void debug_prepare_standby(void) {
+    // Enable start-of-frame detection
+    USART0.CTRLB = USART_SFDEN_bm | USART_RXEN_bm;
+    // Enable RX interrupts
+    USART0.CTRLA = USART_RXSIE_bm | USART_RXCIE_bm;
+}
+
+#endif
+
+#if ENABLE_LOG_RING
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 64
+#endif
+
+static struct {
+    char buf[LOG_RING_SIZE];
+    uint8_t head;
+    uint8_t tail;
+    uint8_t lost;
+} log_ring;
+
+static void log_ring_put(char c) {
+    LOCKI();
+    uint8_t newhead = (log_ring.head + 1) % LOG_RING_SIZE;
+    if (newhead != log_ring.tail) {
+        log_ring.buf[log_ring.head] = c;
+        log_ring.head = newhead;
+    } else if (log_ring.lost < 0xFF) {
+        // ring is full, drop character
+        ++log_ring.lost;
+    }
+    UNLOCKI();
+}
+
+void debug_log_read(uint8_t *dst, uint8_t len) {
+    dst[0] = log_ring.lost;
+    log_ring.lost = 0;
+
+    uint8_t n = 0;
+    for (uint8_t i = 2; i < len; ++i) {
+        if (log_ring.tail != log_ring.head) {
+            dst[i] = log_ring.buf[log_ring.tail];
+            log_ring.tail = (log_ring.tail + 1) % LOG_RING_SIZE;
+            ++n;
+        } else {
+            dst[i] = 0;
+        }
+    }
+    dst[1] = n;
+}
+
+#endif
+
+#if ENABLE_LOG
+
+uint8_t log_mask = 0xFF;
+uint8_t log_level = LOG_DEBUG;
+
+void debug_putchar(char c) {
+#if ENABLE_LOG_RING
+    log_ring_put(c);
+#endif
+#ifndef NO_SERIAL
+    serial_putchar(c);
+#endif
+}
+
 void debug_puts_p(const __flash char *str) {
     for (const __flash char *c = str; *c != '\0'; ++c) {
         debug_putchar(*c);
@@ -217,66 +338,6 @@ void debug_puthex_u16(uint16_t u) {
     puthex_digit(u & 0xF);
 }
 
-void debug_write(const char *str, uint8_t len) {
-    while (len > 0) {
-        uint8_t n = (serial.send.head + TX_BUFFER_SIZE - serial.send.tail - 1) %
-                    TX_BUFFER_SIZE;
-        if (n == 0) {
-            dbg_wait_tx((serial.send.tail + 1) % TX_BUFFER_SIZE);
-            continue;
-        }
-
-        if (n > len) {
-            n = len;
-        }
-
-        if (serial.send.tail + n >= TX_BUFFER_SIZE) {
-            uint8_t c = TX_BUFFER_SIZE - serial.send.tail;
-            memcpy(serial.send.buf + serial.send.tail, str, c);
-            str += c;
-            len -= c;
-            n -= c;
-            serial.send.tail = 0;
-        }
-
-        memcpy(serial.send.buf, str, n);
-        dbg_push_tail(serial.send.tail + n);
-
-        str += n;
-        len -= n;
-    }
-}
-
-void debug_finish(void) {
-    cli();
-    set_sleep_mode(SLEEP_MODE_IDLE);
-    while (!serial.tx_complete) {
-        sleep_enable();
-        sei();
-        sleep_cpu();
-        sleep_disable();
-        cli();
-    }
-    sei();
-}
-
-void debug_stop(void) {
-    debug_finish();
-    // disable all interrupts
-    USART0.CTRLA = 0;
-    // From errata:
-    // Make sure the receiver is enabled while disabling the transmitter.
-    USART0.CTRLB = USART_RXEN_bm;
-    USART0.CTRLB = 0;
-}
-
-void debug_prepare_standby(void) {
-    // Enable start-of-frame detection
-    USART0.CTRLB = USART_SFDEN_bm | USART_RXEN_bm;
-    // Enable RX interrupts
-    USART0.CTRLA = USART_RXSIE_bm | USART_RXCIE_bm;
-}
-
 #endif
 
 #if ENABLE_CHECKPOINTS
@@ -328,6 +389,9 @@ void debug_init_trace(void) {
 }
 
 void debug_dump_trace(void) {
+    if (!LOG_ON(LOG_WARN)) {
+        return;
+    }
     if ((s_trace.index & 1) == 0 && s_trace.index < sizeof(s_trace.addr)) {
         LOGS("trace:");
         uint8_t i = s_trace.index / 2;
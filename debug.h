@@ -10,11 +10,112 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+/// Log levels, lower values are more important.
+#define LOG_ERROR 1
+#define LOG_WARN  2
+#define LOG_INFO  3
+#define LOG_DEBUG 4
+
+/// Modules with individual log level.
+/// A source file selects its module by defining LOG_MODULE before including
+/// this header.
+#define LOG_MOD_MAIN    0
+#define LOG_MOD_TWI     1
+#define LOG_MOD_STEPPER 2
+#define LOG_MOD_HX711   3
+#define LOG_MOD_BUCKETS 4
+#define LOG_MOD_FEEDER  5
+
+/// Compile time log level, log sites above it are removed.
+/// Can be overridden per module, e.g. -DLOG_LEVEL_STEPPER=LOG_DEBUG.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+#ifndef LOG_LEVEL_MAIN
+#define LOG_LEVEL_MAIN LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_TWI
+#define LOG_LEVEL_TWI LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_STEPPER
+#define LOG_LEVEL_STEPPER LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_HX711
+#define LOG_LEVEL_HX711 LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_BUCKETS
+#define LOG_LEVEL_BUCKETS LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_FEEDER
+#define LOG_LEVEL_FEEDER LOG_LEVEL
+#endif
+
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MOD_MAIN
+#endif
+
+#if LOG_MODULE == LOG_MOD_MAIN
+#define LOG_MODULE_LEVEL LOG_LEVEL_MAIN
+#elif LOG_MODULE == LOG_MOD_TWI
+#define LOG_MODULE_LEVEL LOG_LEVEL_TWI
+#elif LOG_MODULE == LOG_MOD_STEPPER
+#define LOG_MODULE_LEVEL LOG_LEVEL_STEPPER
+#elif LOG_MODULE == LOG_MOD_HX711
+#define LOG_MODULE_LEVEL LOG_LEVEL_HX711
+#elif LOG_MODULE == LOG_MOD_BUCKETS
+#define LOG_MODULE_LEVEL LOG_LEVEL_BUCKETS
+#elif LOG_MODULE == LOG_MOD_FEEDER
+#define LOG_MODULE_LEVEL LOG_LEVEL_FEEDER
+#else
+#error "Unknown LOG_MODULE"
+#endif
+
+/// Log output is available if it goes to serial or to the log ring.
+#if !defined(NO_SERIAL) || ENABLE_LOG_RING
+#define ENABLE_LOG 1
+#else
+#define ENABLE_LOG 0
+#endif
+
 #ifndef NO_SERIAL
 
 void debug_init(void);
 bool debug_char_pending(void);
 char debug_getchar(void);
+void debug_finish(void);
+void debug_prepare_standby(void);
+void debug_stop(void);
+
+#else
+
+inline void debug_init(void) {}
+inline bool debug_char_pending(void) {
+    return false;
+}
+inline char debug_getchar(void) {
+    return EOF;
+}
+inline void debug_finish(void) {}
+inline void debug_prepare_standby(void) {}
+inline void debug_stop(void) {}
+
+#endif
+
+#if ENABLE_LOG
+
+/// Runtime log mask with one bit per module.
+extern uint8_t log_mask;
+/// Runtime log level applied to all modules.
+extern uint8_t log_level;
+
+static inline bool log_enabled(uint8_t module, uint8_t level) {
+    return (log_mask & (1 << module)) != 0 && level <= log_level;
+}
+
+/// Check whether log output of given level is enabled for current module.
+/// Evaluates to constant false if level is above compile time log level.
+#define LOG_ON(LVL) ((LVL) <= LOG_MODULE_LEVEL && log_enabled(LOG_MODULE, LVL))
+
 void debug_putchar(char c);
 void debug_puts_p(const __flash char *str);
 void debug_putdec_u8(uint8_t u);
@@ -22,9 +123,6 @@ void debug_putdec_u16(uint16_t u);
 void debug_putdec_u32(uint32_t u);
 void debug_puthex_u8(uint8_t u);
 void debug_puthex_u16(uint16_t u);
-void debug_finish(void);
-void debug_prepare_standby(void);
-void debug_stop(void);
 
 #define LOGS(MSG)     debug_puts_p(FSTR(MSG))
 #define LOGC(C)       debug_putchar(C)
@@ -37,30 +135,33 @@ void debug_stop(void);
 
 #else
 
-inline void debug_init(void) {}
-inline bool debug_char_pending(void) {
-    return false;
-}
-inline char debug_getchar(void) {
-    return EOF;
-}
-inline void debug_finish(void) {}
-inline void debug_prepare_standby(void) {}
-inline void debug_stop(void) {}
-
-inline static void ignore_p(void *m) {}
+inline static void ignore_p(const void *m) {}
 inline static void ignore_i(intptr_t i) {}
 
+#define LOG_ON(LVL) false
+
 #define LOGS(MSG)     ignore_p(MSG)
 #define LOGC(C)       ignore_i(C)
 #define LOGNL()       ignore_i(0)
 #define LOGHEX(N)     ignore_i(N)
+#define LOGHEX_U16(N) ignore_i(N)
 #define LOGDEC(N)     ignore_i(N)
 #define LOGDEC_U16(N) ignore_i(N)
 #define LOGDEC_U32(N) ignore_i(N)
 
 #endif
 
+#if ENABLE_LOG_RING
+/**
+ * @brief Drain log ring into TWI response.
+ *
+ * Fills @p dst with number of lost characters since last read, number of
+ * valid characters and the characters, padded to @p len bytes.
+ * Called from TWI interrupt.
+ */
+void debug_log_read(uint8_t *dst, uint8_t len);
+#endif
+
 #if ENABLE_CHECKPOINTS
 void debug_init_trace(void);
 void debug_dump_trace(void);
@@ -0,0 +1,169 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#define LOG_MODULE LOG_MOD_FEEDER
+
+#include "feeder.h"
+
+#include "debug.h"
+#include "stepper.h"
+
+/// Number of samples to estimate flow before the speed is adjusted, 3.2 s
+/// at the 10 SPS FEED always selects.
+#define SETTLE_SAMPLES 32
+/// Gains of alpha-beta filter estimating weight and flow, alpha = 1/2^A_SHIFT
+/// and beta = 1/2^B_SHIFT. Critical damping needs beta = (1 - sqrt(1 -
+/// alpha))^2, about 1/992 for alpha = 1/16, so 1/1024 is slightly overdamped
+/// and the flow estimate does not ring after speed changes.
+#define A_SHIFT 4
+#define B_SHIFT 10
+/// Fraction bits of filtered weight and flow.
+#define W_SHIFT 10
+/// Speed moves by 1/2^GAIN_SHIFT of its error towards target per sample.
+#define GAIN_SHIFT 5
+/// RTC ticks per minute
+#define TICKS_PER_MIN (1024L * 60)
+/// Lowest speed for which the step period fits into the timer.
+#define MIN_SPS ((uint16_t)(F_CPU / 0xFFFFUL + 1))
+
+static struct {
+    /// Filtered weight relative to ref scaled by 2^W_SHIFT
+    int32_t w;
+    uint32_t ref;
+    /// Filtered weight loss per sample scaled by 2^W_SHIFT
+    int32_t v;
+    /// Time of previous sample
+    uint16_t time;
+    /// Lowest weight since start or end of last refill
+    uint32_t base;
+    /// Highest weight during refill
+    uint32_t peak;
+    /// Estimated flow in weight units per minute
+    int32_t rate;
+    uint16_t target;
+    uint16_t sps;
+    uint16_t refill;
+    /// Samples until flow estimate is valid, or samples without weight
+    /// increase until refill is considered done.
+    uint8_t settle;
+    bool refilling;
+    bool started;
+} feeder;
+
+void feeder_start(bool dir, uint16_t rate, uint16_t sps, uint16_t refill) {
+    feeder.target = rate;
+    feeder.sps = sps < MIN_SPS ? MIN_SPS : sps;
+    feeder.refill = refill;
+    feeder.v = 0;
+    feeder.rate = 0;
+    feeder.settle = SETTLE_SAMPLES;
+    feeder.refilling = false;
+    feeder.started = false;
+    stepper_run(dir, feeder.sps);
+}
+
+static void feeder_adjust(void) {
+    if (feeder.rate <= 0) {
+        // No flow measured, e.g. hopper empty or auger blocked
+        return;
+    }
+    // Flow is proportional to speed, so scale speed by ratio of flows.
+    int32_t ideal = (int32_t)feeder.sps * feeder.target / feeder.rate;
+    if (ideal > 2L * feeder.sps) {
+        ideal = 2L * feeder.sps;
+    }
+    int32_t sps = feeder.sps + ((ideal - feeder.sps) >> GAIN_SHIFT);
+    if (sps < MIN_SPS) {
+        sps = MIN_SPS;
+    } else if (sps > UINT16_MAX) {
+        sps = UINT16_MAX;
+    }
+    feeder.sps = sps;
+    stepper_set_speed(feeder.sps);
+}
+
+/// Restart weight estimate at given weight, keeping the flow estimate.
+static void feeder_restart(uint32_t w) {
+    feeder.ref = w;
+    feeder.w = 0;
+    feeder.base = w;
+}
+
+void feeder_update(uint32_t w, uint16_t time) {
+    uint16_t dt = time - feeder.time;
+    feeder.time = time;
+    if (!feeder.started) {
+        feeder.started = true;
+        feeder_restart(w);
+        return;
+    }
+
+    if (feeder.refilling) {
+        // Refill is done when weight stops increasing.
+        if (w > feeder.peak) {
+            feeder.peak = w;
+            feeder.settle = SETTLE_SAMPLES;
+        } else if (--feeder.settle == 0) {
+            feeder.refilling = false;
+            feeder.settle = SETTLE_SAMPLES;
+            feeder_restart(w);
+            if (LOG_ON(LOG_INFO)) {
+                LOGS("F: fed\n");
+            }
+        }
+        return;
+    }
+
+    if (feeder.refill != 0 && w > feeder.base + feeder.refill) {
+        // Keep running at current speed while hopper is refilled.
+        feeder.refilling = true;
+        feeder.peak = w;
+        feeder.settle = SETTLE_SAMPLES;
+        if (LOG_ON(LOG_INFO)) {
+            LOGS("F: refill\n");
+        }
+        return;
+    }
+    if (w < feeder.base) {
+        feeder.base = w;
+    }
+
+    // Alpha-beta filter, as single samples are too noisy for differences.
+    int32_t pred = feeder.w - feeder.v;
+    int32_t e = ((int32_t)(w - feeder.ref) << W_SHIFT) - pred;
+    feeder.w = pred + (e >> A_SHIFT);
+    feeder.v -= e >> B_SHIFT;
+    if (dt != 0) {
+        int32_t per_min = TICKS_PER_MIN / dt;
+        feeder.rate = (feeder.v >> 2) * per_min >> (W_SHIFT - 2);
+    }
+
+    if (feeder.settle != 0) {
+        --feeder.settle;
+        return;
+    }
+    feeder_adjust();
+
+    if (LOG_ON(LOG_DEBUG)) {
+        LOGS("F:");
+        LOGDEC_U32(feeder.rate);
+        LOGC(' ');
+        LOGDEC_U16(feeder.sps);
+        LOGNL();
+    }
+}
+
+void feeder_get_state(struct feeder_state *state) {
+    int32_t rate = feeder.rate;
+    if (rate > INT16_MAX) {
+        rate = INT16_MAX;
+    } else if (rate < INT16_MIN) {
+        rate = INT16_MIN;
+    }
+    state->rate = rate;
+    state->sps = feeder.sps;
+    state->flags = (feeder.refilling ? FEEDER_REFILL : 0) |
+                   (feeder.settle != 0 ? FEEDER_SETTLING : 0);
+}
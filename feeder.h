@@ -0,0 +1,47 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Flags of feeder state.
+enum {
+    FEEDER_REFILL = 0x01,
+    FEEDER_SETTLING = 0x02,
+};
+
+struct feeder_state {
+    /// Estimated mass flow in weight units per minute.
+    int16_t rate;
+    /// Current auger speed in steps per second.
+    uint16_t sps;
+    uint8_t flags;
+};
+
+/**
+ * @brief Start loss-in-weight feeding.
+ *
+ * Runs the stepper continuously and adjusts its speed with every weight
+ * sample to hold the target mass flow out of the hopper.
+ *
+ * @param dir Direction of rotation
+ * @param rate Target mass flow in weight units per minute
+ * @param sps Initial speed in steps per second
+ * @param refill Weight increase that indicates a refill of the hopper,
+ *               0 disables refill detection
+ */
+void feeder_start(bool dir, uint16_t rate, uint16_t sps, uint16_t refill);
+
+/**
+ * @brief Update controller with new weight sample.
+ *
+ * @param w Weight
+ * @param time Time of sample in RTC ticks of 1/1024s
+ */
+void feeder_update(uint32_t w, uint16_t time);
+
+void feeder_get_state(struct feeder_state *state);
@@ -3,14 +3,18 @@
     SPDX-License-Identifier: MIT
 */
 
+#define LOG_MODULE LOG_MOD_HX711
+
 #include "hx711.h"
 
 #include "config.h"
 #include "debug.h"
+#include "timer.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/sleep.h>
+#include <util/delay.h>
 
 #define SPI_OFF (SPI_MASTER_bm | SPI_PRESC_DIV16_gc)
 #define SPI_ON (SPI_OFF | SPI_ENABLE_bm)
@@ -23,8 +27,15 @@ typedef enum {
     HX711_OFF,
 } hx711_state_t;
 
+/// Conversions until output has settled after change of rate
+#define SETTLE_SAMPLES 4
+
 struct {
     volatile uint8_t first;
+#if ENABLE_HX711_RATE
+    /// Number of samples still to discard.
+    volatile uint8_t discard;
+#endif
     volatile uint32_t data;
     volatile hx711_state_t state;
 } hx711;
@@ -67,6 +78,12 @@ ISR(SPI0_INT_vect) {
         d[0] = SPI0.DATA;
         // Copy first byte
         d[2] = hx711.first;
+#if ENABLE_HX711_RATE
+        if (hx711.discard != 0) {
+            --hx711.discard;
+            hx711.data = 0;
+        }
+#endif
         // HX711 requires 25 pulses on SCK. So far there were 24 pulses for
         // three bytes of SPI transfer.
         // Disabling SPI will activate PORT settings of SCK,
@@ -85,19 +102,19 @@ ISR(SPI0_INT_vect) {
     }
 }
 
-ISR(TCB0_INT_vect) {
-    if ((TCB0.INTFLAGS & TCB_CAPT_bm) != 0) {
-        hx711.state = HX711_OFF;
-        // Stop timer
-        TCB0.CTRLA = 0;
-        // Disable interrupt
-        TCB0.INTCTRL = 0;
-        // Clear interrupt flag
-        TCB0.INTFLAGS = TCB_CAPT_bm;
-    }
+/// Called from TCB0 interrupt when the powerdown timer has elapsed.
+void hx711_powerdown_elapsed(void) {
+    hx711.state = HX711_OFF;
+    // Stop timer and disable interrupt
+    timer_tcb_release(TIMER_TCB_HX711);
 }
 
 void hx711_init(void) {
+#if ENABLE_HX711_RATE
+    // Start with 10 SPS
+    RATE_PORT.OUTCLR = RATE_BIT;
+    RATE_PORT.DIRSET = RATE_BIT;
+#endif
     // Start powerdown timer to ensure hx711 has been off
     // before next read is started.
     hx711_powerdown();
@@ -117,10 +134,15 @@ void hx711_start(void) {
     if (hx711.state == HX711_POWERING_DOWN) {
         hx711_await_poweroff();
     }
+    cli();
+    hx711_start_locked();
+    sei();
+}
+
+void hx711_start_locked(void) {
     hx711.data = 0;
     hx711.state = HX711_AWAIT_DATA_READY;
 
-    cli();
     // Clear interrupt flag for MISO pin
     MISO_PORT.INTFLAGS = MISO_BIT;
     // Enable interrupt for MISO pin sensing falling edge
@@ -130,9 +152,29 @@ void hx711_start(void) {
     SPI0.CTRLA = SPI_ON;
     // Clear interrupt flag for RX complete
     SPI0.INTFLAGS = SPI_RXCIF_bm;
-    sei();
 }
 
+#if ENABLE_HX711_RATE
+void hx711_set_rate(bool fast) {
+    bool is_fast = (RATE_PORT.OUT & RATE_BIT) != 0;
+    if (fast == is_fast) {
+        return;
+    }
+    if (fast) {
+        RATE_PORT.OUTSET = RATE_BIT;
+    } else {
+        RATE_PORT.OUTCLR = RATE_BIT;
+    }
+    // After power up, the HX711 itself waits for settled output.
+    if (hx711_is_active()) {
+        cli();
+        hx711.discard = SETTLE_SAMPLES;
+        hx711.data = 0;
+        sei();
+    }
+}
+#endif
+
 bool hx711_is_data_available(void) {
     return hx711.data != 0;
 }
@@ -177,9 +219,13 @@ void hx711_powerdown(void) {
         // Disable digital input on MISO pin
         MISO_PINCTRL = PORT_ISC_INPUT_DISABLE_gc;
 
+        if (!timer_tcb_claim(TIMER_TCB_HX711)) {
+            // TCB0 is in use by valve or cycle counter, so wait in place
+            _delay_us(60);
+            hx711.state = HX711_OFF;
+            return;
+        }
         // Start timer to wait 60us for hx711 to enter power down mode
-        // First disable timer for configuration
-        TCB0.CTRLA = 0;
         // Periodic interrupt mode
         TCB0.CTRLB = TCB_CNTMODE_INT_gc;
         // Calculate timer ticks for 60us while running with CLKDIV2
@@ -5,15 +5,50 @@
 
 #pragma once
 
+#include "nvm.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
 void hx711_init(void);
 void hx711_start(void);
+/**
+ * @brief Start HX711 that is off, with interrupts disabled.
+ *
+ * Can be called from interrupts.
+ */
+void hx711_start_locked(void);
 bool hx711_is_data_available(void);
 bool hx711_is_off(void);
 bool hx711_is_active(void);
 uint32_t hx711_data(void);
 uint32_t hx711_read(void);
 void hx711_powerdown(void);
+void hx711_powerdown_elapsed(void);
+
+#if ENABLE_HX711_RATE
+/**
+ * @brief Select sample rate with RATE pin of HX711.
+ *
+ * Samples of a running conversion are discarded until the output of the
+ * HX711 has settled at the new rate.
+ *
+ * @param fast true for 80 SPS, false for 10 SPS
+ */
+void hx711_set_rate(bool fast);
+#else
+static inline void hx711_set_rate(bool fast) {}
+#endif
 void hx711_await_poweroff(void);
+
+/// Convert raw HX711 result to weight with calibration data.
+static inline uint32_t calculate_weight(uint32_t result) {
+    if (result < calib_data.hx711.offset) {
+        return 0UL;
+    }
+    uint16_t s = calib_data.hx711.scale;
+    uint32_t r = result - calib_data.hx711.offset;
+    uint32_t a = r * (uint8_t)(s >> 8);
+    uint32_t b = r * (uint8_t)(s & 0xff) / 256UL;
+    return (a + b) / 256UL;
+}
@@ -0,0 +1,119 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#include "interlock.h"
+
+#include "nvm.h"
+#include "stepper.h"
+#include "timer.h"
+#include "twi.h"
+#include "valve.h"
+
+#define TICKS_PER_S 1024UL
+/// Rate is measured over at least 100ms to be independent of sample rate.
+#define RATE_TICKS (TICKS_PER_S / 10)
+/// Runtime is also checked with this period, independent of samples.
+#define RUNTIME_TICKS TICKS_PER_S
+
+static struct {
+    /// Weight and time at start of rate window
+    uint32_t w;
+    uint16_t time;
+    /// Time runtime was last updated
+    uint16_t last;
+    /// Time valve or stepper has been active in RTC ticks.
+    uint32_t active;
+    volatile uint8_t reason;
+    bool started;
+} interlock;
+
+static uint8_t interlock_trip(uint8_t reason) {
+    valve_close();
+    stepper_stop();
+    interlock.reason = reason;
+    return reason;
+}
+
+static bool is_active(void) {
+    return valve_is_open() || stepper_is_running();
+}
+
+/// Add time since last update to runtime of valve or stepper.
+static bool runtime_exceeded(uint16_t time) {
+    uint16_t step = time - interlock.last;
+    interlock.last = time;
+    if (!is_active()) {
+        // Rate window starts with the first sample of the next activity.
+        interlock.started = false;
+        interlock.active = 0;
+        return false;
+    }
+    interlock.active += step;
+    return interlock.active > limits_config.max_runtime * TICKS_PER_S;
+}
+
+static void schedule(void) {
+    if (is_active()) {
+        timer_set_alarm(interlock.last + RUNTIME_TICKS);
+    } else {
+        timer_clear_alarm();
+    }
+}
+
+uint8_t interlock_check(uint32_t w, uint16_t time) {
+    if (!interlock.started) {
+        interlock.started = true;
+        interlock.w = w;
+        interlock.time = time;
+    }
+    bool exceeded = runtime_exceeded(time);
+
+    if (!is_active()) {
+        return TWI_TRIP_NONE;
+    }
+    if (w > limits_config.max_weight) {
+        return interlock_trip(TWI_TRIP_WEIGHT);
+    }
+
+    uint16_t dt = time - interlock.time;
+    if (dt >= RATE_TICKS) {
+        uint32_t dw = w > interlock.w ? w - interlock.w : interlock.w - w;
+        interlock.w = w;
+        interlock.time = time;
+        if (dw > UINT32_MAX / TICKS_PER_S ||
+            dw * TICKS_PER_S > (uint32_t)limits_config.max_rate * dt) {
+            return interlock_trip(TWI_TRIP_RATE);
+        }
+    }
+    if (exceeded) {
+        return interlock_trip(TWI_TRIP_RUNTIME);
+    }
+    return TWI_TRIP_NONE;
+}
+
+uint8_t interlock_poll(uint16_t time) {
+    uint8_t reason = TWI_TRIP_NONE;
+    if (runtime_exceeded(time)) {
+        reason = interlock_trip(TWI_TRIP_RUNTIME);
+    }
+    schedule();
+    return reason;
+}
+
+void interlock_rebase(void) {
+    uint16_t now = timer_get_time();
+    interlock.time += now - interlock.last;
+    interlock.last = now;
+    schedule();
+}
+
+uint8_t interlock_reason(void) {
+    return interlock.reason;
+}
+
+void interlock_clear(void) {
+    interlock.reason = TWI_TRIP_NONE;
+    interlock.active = 0;
+}
@@ -0,0 +1,50 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Check limits of limits_config with new weight sample.
+ *
+ * Limits are only checked while the valve is open or the stepper is
+ * running. On violation, the valve is closed, the stepper is stopped and
+ * the reason is latched until interlock_clear().
+ *
+ * @param w Weight
+ * @param time Time of sample in RTC ticks of 1/1024s
+ * @return Trip reason TWI_TRIP_*, or TWI_TRIP_NONE
+ */
+uint8_t interlock_check(uint32_t w, uint16_t time);
+
+/**
+ * @brief Check runtime limit without weight sample.
+ *
+ * Called on the alarm of the RTC, which is set while valve or stepper is
+ * active, so the runtime limit holds even if the HX711 stops sampling.
+ *
+ * @param time Current time in RTC ticks of 1/1024s
+ * @return Trip reason TWI_TRIP_*, or TWI_TRIP_NONE
+ */
+uint8_t interlock_poll(uint16_t time);
+
+/**
+ * @brief Shift stored times after restart of the RTC.
+ *
+ * Call interlock_poll() right before timer_start() and this right after,
+ * so runtime and rate window continue across the restart.
+ */
+void interlock_rebase(void);
+
+/// Get latched trip reason.
+uint8_t interlock_reason(void);
+
+static inline bool interlock_tripped(void) {
+    return interlock_reason() != 0;
+}
+
+void interlock_clear(void);
@@ -3,14 +3,20 @@
     SPDX-License-Identifier: MIT
 */
 
+#include "bench.h"
 #include "buckets.h"
 #include "config.h"
 #include "debug.h"
+#include "feeder.h"
 #include "hx711.h"
+#include "interlock.h"
+#include "noise.h"
 #include "nvm.h"
 #include "stepper.h"
 #include "timer.h"
+#include "trigger.h"
 #include "twi.h"
+#include "valve.h"
 #include "version.h"
 
 #include <avr/eeprom.h>
@@ -47,13 +53,6 @@ static void early_init(void) {
     }
 }
 
-static void valve_init(void) {
-    // Set valve pin low
-    VALVE_PORT.OUTCLR = VALVE_BIT;
-    // Set valve pin as output
-    VALVE_PORT.DIRSET = VALVE_BIT;
-}
-
 static volatile uint16_t adc0_res;
 
 ISR(ADC0_RESRDY_vect) {
@@ -115,33 +114,14 @@ static int16_t measure_temperature(void) {
     return temp - 4370; // Celsius * 16 = K * 16 - 273.15 * 16
 }
 
-static inline uint32_t calculate_weight(uint32_t result) {
-    if (result < calib_data.hx711.offset) {
-        return 0UL;
-    }
-    uint16_t s = calib_data.hx711.scale;
-    uint32_t r = result - calib_data.hx711.offset;
-    uint32_t a = r * (uint8_t)(s >> 8);
-    uint32_t b = r * (uint8_t)(s & 0xff) / 256UL;
-    return (a + b) / 256UL;
-}
-
-static inline void open_valve(void) {
-    VALVE_PORT.OUTSET = VALVE_BIT;
-}
-
-static inline void close_valve(void) {
-    VALVE_PORT.OUTCLR = VALVE_BIT;
-}
-
 static inline void start_watchdog(void) {
     // wait for any pending WDT sync
     while ((WDT.STATUS & WDT_SYNCBUSY_bm) != 0)
         ;
 
-    LOCKI();
-    wdt_enable(WDT_PERIOD_8KCLK_gc);
-    UNLOCKI();
+    // Unlike wdt_enable(), do not wait some milliseconds for synchronization
+    // of the new setting, which would delay commands waking the device.
+    _PROTECTED_WRITE(WDT.CTRLA, WDT_PERIOD_8KCLK_gc);
 }
 
 static void shutdown(uint8_t mode) {
@@ -158,7 +138,7 @@ static void shutdown(uint8_t mode) {
         debug_prepare_standby();
     }
 
-    close_valve();
+    valve_close();
     timer_stop();
 
     // stop watchdog
@@ -166,6 +146,7 @@ static void shutdown(uint8_t mode) {
     set_sleep_mode(mode);
     sleep_enable();
     if (!twi_busy()) {
+        twi_arm_latency(mode == SLEEP_MODE_PWR_DOWN);
         sei();
         sleep_cpu();
     } else {
@@ -177,7 +158,9 @@ static void shutdown(uint8_t mode) {
         // restart watchdog
         start_watchdog();
     }
-    debug_init();
+    if (mode != SLEEP_MODE_IDLE) {
+        debug_init();
+    }
 }
 
 static uint8_t last_stepper_cycle = 0;
@@ -196,7 +179,10 @@ static void wait_for_input(void) {
     set_sleep_mode(SLEEP_MODE_IDLE);
     sleep_enable();
     while (!twi_task_pending() && !hx711_is_data_available() &&
-           !debug_char_pending() && !stepper_has_new_cycle()) {
+           !debug_char_pending() && !stepper_has_new_cycle() &&
+           !twi_temp_requested() && !stepper_home_pending() &&
+           !trigger_pending() && !timer_alarm_pending()) {
+        twi_arm_latency(false);
         sei();
         sleep_cpu();
         cli();
@@ -204,6 +190,7 @@ static void wait_for_input(void) {
             wdt_reset();
         }
     }
+    twi_disarm_latency();
     sleep_disable();
     sei();
 }
@@ -212,22 +199,96 @@ struct twi_data twi_data = {.task = TWI_CMD_NONE, .count = 0};
 
 static bool expect_twi_data(uint8_t count) {
     if (twi_data.count != count) {
-        LOGHEX(twi_data.task);
-        LOGS(": inv: ");
-        LOGDEC(twi_data.count);
-        LOGNL();
+        if (LOG_ON(LOG_WARN)) {
+            LOGHEX(twi_data.task);
+            LOGS(": inv: ");
+            LOGDEC(twi_data.count);
+            LOGNL();
+        }
         return false;
     }
     return true;
 }
 
+// Only whole pages are received.
+_Static_assert(sizeof(struct tare_table) <=
+                   TWI_BLOB_SIZE / TWI_BLOB_PAGE * TWI_BLOB_PAGE,
+               "Tare table does not fit into blob");
+
+static bool commit_blob(uint8_t region) {
+    uint8_t len;
+    const uint8_t *blob = twi_get_blob(&len);
+    if (!nvm_set_region(region, blob, len)) {
+        if (LOG_ON(LOG_WARN)) {
+            LOGS("blob: inv: ");
+            LOGDEC(region);
+            LOGC(' ');
+            LOGDEC(len);
+            LOGNL();
+        }
+        return false;
+    }
+    return true;
+}
+
+static bool is_stepper_task(uint8_t task) {
+    return task == TWI_CMD_ROTATE || task == TWI_CMD_MOVE_TO ||
+           task == TWI_CMD_HOME || task == TWI_CMD_FEED;
+}
+
+static bool is_actuator_task(uint8_t task) {
+    return is_stepper_task(task) || task == TWI_CMD_OPEN_VALVE;
+}
+
+/// Tasks which need the HX711.
+static bool is_weight_task(uint8_t task) {
+    return task == TWI_CMD_MEASURE_WEIGHT || task == TWI_CMD_TRACK_WEIGHT ||
+           task == TWI_CMD_FEED || task == TWI_CMD_NOISE_TEST ||
+           task == TWI_CMD_ARM_TRIGGER;
+}
+
+static void log_trip(uint8_t trip) {
+    if (trip != TWI_TRIP_NONE && LOG_ON(LOG_WARN)) {
+        LOGS("TRIP ");
+        LOGDEC(trip);
+        LOGNL();
+    }
+}
+
+/// Restart RTC at zero without losing runtime of valve and stepper.
+static void restart_timer(void) {
+    log_trip(interlock_poll(timer_get_time()));
+    timer_start();
+    interlock_rebase();
+}
+
 static void start_hx711(void) {
     hx711_start();
 }
 
+static void update_temperature(void) {
+    int16_t t = measure_temperature();
+    twi_set_temp(t);
+    if (LOG_ON(LOG_INFO)) {
+        int16_t i = t >> 4;
+        uint8_t f = (((t > 0 ? t : -t) & 0xF) * 10) >> 4;
+        LOGS("T: ");
+        LOGDEC(i);
+        LOGC('.');
+        LOGDEC(f);
+        LOGNL();
+    }
+}
+
+/// Task started by trigger.
+static uint8_t trigger_task;
+
 static void loop(void) {
+    uint16_t samples = 0;
     for (;;) {
-        LOGS("> ");
+        if (LOG_ON(LOG_DEBUG)) {
+            LOGS("> ");
+        }
         CHECKPOINT;
         wait_for_input();
         CHECKPOINT;
@@ -240,102 +301,218 @@ static void loop(void) {
         }
         if (twi_task_pending()) {
             twi_read(&twi_data);
+            if (interlock_tripped() && is_actuator_task(twi_data.task)) {
+                if (LOG_ON(LOG_WARN)) {
+                    LOGS("trip: ");
+                    LOGHEX(twi_data.task);
+                    LOGNL();
+                }
+                twi_data.task = TWI_CMD_NONE;
+            }
+            if (is_stepper_task(twi_data.task)) {
+                stepper_begin_command();
+            }
             switch (twi_data.task) {
             case TWI_CMD_SLEEP:
-                LOGS("S\n");
+                if (LOG_ON(LOG_INFO)) {
+                    LOGS("S\n");
+                }
                 shutdown(SLEEP_MODE_PWR_DOWN);
                 break;
             case TWI_CMD_TRACK_WEIGHT:
-                timer_start();
+                restart_timer();
+                hx711_set_rate(true);
                 if (!hx711_is_active()) {
                     start_hx711();
-                    LOGS("WT\n");
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("WT\n");
+                    }
                 }
                 break;
             case TWI_CMD_MEASURE_WEIGHT:
+                restart_timer();
+                // Minimal bucket width is tuned for 10 SPS.
+                hx711_set_rate(false);
                 buckets_reset();
-                LOGS("M\n");
+                if (LOG_ON(LOG_INFO)) {
+                    LOGS("M\n");
+                }
                 if (!hx711_is_active()) {
                     start_hx711();
                 }
                 break;
-            case TWI_CMD_GET_TEMP: {
-                int16_t t = measure_temperature();
-                uint8_t d[2];
-                write_big_endian_u16(d, t);
-                twi_write(sizeof(d), d);
-                int16_t i = t >> 4;
-                uint8_t f = (((t > 0 ? t : -t) & 0xF) * 10) >> 4;
-                LOGS("T: ");
-                LOGDEC(i);
-                LOGC('.');
-                LOGDEC(f);
-                LOGNL();
+            case TWI_CMD_NOISE_TEST:
+                if (expect_twi_data(1)) {
+                    restart_timer();
+                    noise_start(twi_data.buf[0]);
+                    hx711_set_rate(false);
+                    if (!hx711_is_active()) {
+                        start_hx711();
+                    }
+                }
+                break;
+            case TWI_CMD_BENCHMARK:
+#if ENABLE_BENCH
+                if (expect_twi_data(2)) {
+                    uint8_t data[BENCH_RESULT_SIZE];
+                    bench_run(twi_data.buf[0], twi_data.buf[1], data);
+                    twi_write(BENCH_RESULT_SIZE, data);
+                }
+#endif
                 break;
-            }
             case TWI_CMD_OPEN_VALVE:
-                open_valve();
+                valve_open();
                 break;
             case TWI_CMD_CLOSE_VALVE:
-                close_valve();
+                valve_close();
+                break;
+            case TWI_CMD_ARM_TRIGGER:
+                if (expect_twi_data(2) &&
+                    (twi_data.buf[0] == TWI_CMD_MEASURE_WEIGHT ||
+                     twi_data.buf[0] == TWI_CMD_TRACK_WEIGHT)) {
+                    trigger_task = twi_data.buf[0];
+                    // Time of edge is relative to this start of RTC.
+                    restart_timer();
+                    hx711_await_poweroff();
+                    hx711_set_rate(trigger_task == TWI_CMD_TRACK_WEIGHT);
+                    trigger_arm((twi_data.buf[1] & TWI_TRIGGER_RISING) != 0);
+                }
+                break;
+            case TWI_CMD_CLEAR_TRIP:
+                interlock_clear();
                 break;
             case TWI_CMD_ROTATE:
                 if (expect_twi_data(2)) {
                     bool dir = (twi_data.buf[0] & 0x80) != 0;
                     uint8_t cycles = (twi_data.buf[0] & 0x7F) + 1;
                     uint8_t maxspd = twi_data.buf[1];
-                    LOGS("R ");
-                    LOGC((dir ? '+' : '-'));
-                    LOGDEC(cycles);
-                    LOGC(' ');
-                    LOGDEC(maxspd);
-                    LOGNL();
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("R ");
+                        LOGC((dir ? '+' : '-'));
+                        LOGDEC(cycles);
+                        LOGC(' ');
+                        LOGDEC(maxspd);
+                        LOGNL();
+                    }
                     stepper_rotate(dir, cycles, maxspd);
                 }
                 break;
+            case TWI_CMD_MOVE_TO:
+                if (expect_twi_data(5)) {
+                    uint32_t pos;
+                    read_big_endian_u32(&pos, twi_data.buf);
+                    uint8_t maxspd = twi_data.buf[4];
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("P ");
+                        LOGDEC_U32(pos);
+                        LOGC(' ');
+                        LOGDEC(maxspd);
+                        LOGNL();
+                    }
+                    if (!stepper_move_to((int32_t)pos, maxspd) &&
+                        LOG_ON(LOG_WARN)) {
+                        LOGS("P: far\n");
+                    }
+                }
+                break;
+            case TWI_CMD_HOME:
+                if (expect_twi_data(7)) {
+                    bool dir = (twi_data.buf[0] & 0x80) != 0;
+                    uint16_t backoff, travel;
+                    read_big_endian_u16(&backoff, twi_data.buf + 3);
+                    read_big_endian_u16(&travel, twi_data.buf + 5);
+                    stepper_home(dir, twi_data.buf[1], twi_data.buf[2],
+                                 backoff, travel);
+                }
+                break;
+            case TWI_CMD_FEED:
+                if (expect_twi_data(7)) {
+                    bool dir = (twi_data.buf[0] & 0x80) != 0;
+                    uint16_t rate, sps, refill;
+                    read_big_endian_u16(&rate, twi_data.buf + 1);
+                    read_big_endian_u16(&sps, twi_data.buf + 3);
+                    read_big_endian_u16(&refill, twi_data.buf + 5);
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("F ");
+                        LOGDEC_U16(rate);
+                        LOGC(' ');
+                        LOGDEC_U16(sps);
+                        LOGNL();
+                    }
+                    restart_timer();
+                    // Controller is tuned for 10 SPS
+                    hx711_set_rate(false);
+                    if (!hx711_is_active()) {
+                        start_hx711();
+                    }
+                    feeder_start(dir, rate, sps, refill);
+                }
+                break;
+            case TWI_CMD_SET_KEEP_AWAKE:
+                if (expect_twi_data(2)) {
+                    uint16_t ms;
+                    read_big_endian_u16(&ms, twi_data.buf);
+                    stepper_set_keep_awake(ms);
+                }
+                break;
+            case TWI_CMD_SET_POSITION:
+                if (expect_twi_data(4)) {
+                    uint32_t pos;
+                    read_big_endian_u32(&pos, twi_data.buf);
+                    stepper_set_position((int32_t)pos);
+                }
+                break;
+            case TWI_CMD_SET_MODULUS:
+                if (expect_twi_data(4)) {
+                    uint32_t m;
+                    read_big_endian_u32(&m, twi_data.buf);
+                    if (!stepper_set_modulus(m) && LOG_ON(LOG_WARN)) {
+                        LOGS("mod: inv\n");
+                    }
+                }
+                break;
             case TWI_CMD_DISABLE_WD:
                 if (expect_twi_data(1) && twi_data.buf[0] == TWI_CONFIRM_DISABLE_WD) {
-                    LOGS("W0\n");
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("W0\n");
+                    }
                     wdt_disable();
                     wd_disabled = true;
                 }
                 break;
             case TWI_CMD_ENABLE_WD:
                 if (wd_disabled) {
-                    LOGS("W1\n");
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("W1\n");
+                    }
                     start_watchdog();
                     wd_disabled = false;
                 }
                 break;
-            case TWI_CMD_GET_CALIB: {
-                uint8_t d[6];
-                write_big_endian_u32(d, calib_data.hx711.offset);
-                write_big_endian_u16(d + 4, calib_data.hx711.scale);
-                twi_write(sizeof(d), d);
-                LOGS("GCAL: ");
-                LOGDEC_U32(calib_data.hx711.offset);
-                LOGS(", ");
-                LOGDEC_U16(calib_data.hx711.scale);
-                LOGNL();
-                break;
-            }
             case TWI_CMD_SET_CALIB:
                 if (expect_twi_data(6)) {
+                    // calibration data is read in TWI interrupt
+                    cli();
                     read_big_endian_u32(&calib_data.hx711.offset, twi_data.buf);
                     read_big_endian_u16(&calib_data.hx711.scale,
                                         twi_data.buf + 4);
-                    LOGS("SCAL: ");
-                    LOGDEC_U32(calib_data.hx711.offset);
-                    LOGS(", ");
-                    LOGDEC_U16(calib_data.hx711.scale);
-                    LOGNL();
+                    sei();
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("SCAL: ");
+                        LOGDEC_U32(calib_data.hx711.offset);
+                        LOGS(", ");
+                        LOGDEC_U16(calib_data.hx711.scale);
+                        LOGNL();
+                    }
                 }
                 break;
             case TWI_CMD_CALIB_WRITE:
                 if (expect_twi_data(1) &&
                     twi_data.buf[0] == TWI_CONFIRM_CALIB_WRITE) {
                     nvm_write_calib_data();
-                    LOGS("WCAL\n");
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("WCAL\n");
+                    }
                 }
                 break;
             case TWI_CMD_SET_ADDR:
@@ -348,20 +525,101 @@ static void loop(void) {
                 if (expect_twi_data(1) &&
                     twi_data.buf[0] == TWI_CONFIRM_ADDR_WRITE) {
                     nvm_write_twi_addr();
-                    LOGS("WADR\n");
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("WADR\n");
+                    }
                 }
                 break;
+            case TWI_CMD_SELECT_TARE:
+                if (expect_twi_data(1) && !nvm_select_tare(twi_data.buf[0]) &&
+                    LOG_ON(LOG_WARN)) {
+                    LOGS("tare: inv: ");
+                    LOGDEC(twi_data.buf[0]);
+                    LOGNL();
+                }
+                break;
+            case TWI_CMD_BLOB_COMMIT:
+                if (expect_twi_data(1)) {
+                    commit_blob(twi_data.buf[0]);
+                }
+                break;
+            case TWI_CMD_BLOB_WRITE:
+                if (expect_twi_data(2) &&
+                    twi_data.buf[1] == TWI_CONFIRM_BLOB_WRITE &&
+                    commit_blob(twi_data.buf[0])) {
+                    nvm_write_region(twi_data.buf[0]);
+                    if (LOG_ON(LOG_INFO)) {
+                        LOGS("WBLB\n");
+                    }
+                }
+                break;
+            case TWI_CMD_SET_LOG:
+#if ENABLE_LOG
+                if (expect_twi_data(2)) {
+                    log_mask = twi_data.buf[0];
+                    log_level = twi_data.buf[1];
+                }
+#endif
+                break;
             }
+            stepper_end_command();
 
-            if (twi_data.task != TWI_CMD_MEASURE_WEIGHT &&
-                twi_data.task != TWI_CMD_TRACK_WEIGHT && hx711_is_active()) {
+            // Weight may be tracked while the stepper runs.
+            if (!is_stepper_task(twi_data.task) &&
+                twi_data.task != TWI_CMD_TRACK_WEIGHT &&
+                stepper_is_running()) {
+                stepper_stop();
+            }
+
+            if (valve_is_open() || stepper_is_running()) {
+                // Interlock checks limits with every sample.
+                if (!hx711_is_active()) {
+                    restart_timer();
+                    hx711_set_rate(true);
+                    start_hx711();
+                }
+            } else if (!is_weight_task(twi_data.task) && hx711_is_active()) {
                 hx711_powerdown();
                 timer_stop();
             }
 
-            if (twi_data.task != TWI_CMD_ROTATE && stepper_is_running()) {
-                stepper_stop();
+            if (twi_data.task != TWI_CMD_ARM_TRIGGER) {
+                trigger_disarm();
             }
+
+            if (twi_data.task == TWI_CMD_BLOB_COMMIT ||
+                twi_data.task == TWI_CMD_BLOB_WRITE) {
+                twi_release_blob();
+            }
+
+            samples = 0;
+            twi_set_status(twi_data.task, samples);
+            // Starts or stops runtime and rate window if valve or stepper
+            // changed, else both continue.
+            log_trip(interlock_poll(timer_get_time()));
+        }
+        if (trigger_pending()) {
+            trigger_acknowledge();
+            // HX711 was already started by trigger interrupt.
+            twi_data.task = trigger_task;
+            if (twi_data.task == TWI_CMD_MEASURE_WEIGHT) {
+                buckets_reset();
+            }
+            if (LOG_ON(LOG_INFO)) {
+                LOGS("TRG\n");
+            }
+            samples = 0;
+            twi_set_status(twi_data.task, samples);
+        }
+        if (timer_alarm_pending()) {
+            timer_alarm_acknowledge();
+            log_trip(interlock_poll(timer_get_time()));
+        }
+        if (twi_temp_requested()) {
+            update_temperature();
+        }
+        if (stepper_home_pending()) {
+            stepper_home_update();
         }
         if (twi_data.task == TWI_CMD_ROTATE) {
             last_stepper_cycle = stepper_get_cycle();
@@ -370,12 +628,20 @@ static void loop(void) {
 
         if (hx711_is_data_available()) {
             uint32_t d = hx711_read();
-            uint32_t w = calculate_weight(d);
-            LOGS("w:");
-            LOGDEC_U32(w);
-            LOGC('(');
-            LOGDEC_U32(d);
-            LOGS(")\n");
+            uint32_t gross = calculate_weight(d);
+            log_trip(interlock_check(gross, timer_get_time()));
+            // Limits and feeder apply to gross weight, results are net weight.
+            // Net weight below the tare is sent as two's complement and
+            // buckets average across zero.
+            uint32_t w = (uint32_t)net_weight(gross);
+            twi_set_status(twi_data.task, ++samples);
+            if (LOG_ON(LOG_DEBUG)) {
+                LOGS("w:");
+                LOGDEC_U32(w);
+                LOGC('(');
+                LOGDEC_U32(d);
+                LOGS(")\n");
+            }
             if (twi_data.task == TWI_CMD_TRACK_WEIGHT) {
                 uint16_t rt = timer_get_time();
                 uint8_t t = rt * 250U / 256;
@@ -389,11 +655,34 @@ static void loop(void) {
                     t & 0xFF,
                 };
                 twi_write(6, data);
-                LOGS("t:");
-                LOGDEC(t);
-                LOGC(' ');
-                LOGDEC_U16(rt);
-                LOGNL();
+                if (LOG_ON(LOG_DEBUG)) {
+                    LOGS("t:");
+                    LOGDEC(t);
+                    LOGC(' ');
+                    LOGDEC_U16(rt);
+                    LOGNL();
+                }
+            } else if (twi_data.task == TWI_CMD_NOISE_TEST) {
+                if (noise_add(d)) {
+                    uint8_t data[NOISE_RESULT_SIZE];
+                    noise_result(data);
+                    twi_write(NOISE_RESULT_SIZE, data);
+                    hx711_powerdown();
+                }
+            } else if (twi_data.task == TWI_CMD_FEED) {
+                feeder_update(gross, timer_get_time());
+                struct feeder_state f;
+                feeder_get_state(&f);
+                uint8_t data[7] = {
+                    (w >> 24) & 0xff,
+                    (w >> 16) & 0xff,
+                    (w >> 8) & 0xff,
+                    w & 0xff,
+                    (f.rate >> 8) & 0xff,
+                    f.rate & 0xff,
+                    f.flags,
+                };
+                twi_write(7, data);
             } else if (twi_data.task == TWI_CMD_MEASURE_WEIGHT) {
                 buckets_add(w);
                 // buckets_dump();
@@ -408,15 +697,17 @@ static void loop(void) {
                     r.span,
                 };
                 twi_write(7, data);
-                LOGS("c:");
-                LOGDEC_U32(r.sum);
-                LOGC(' ');
-                LOGDEC(r.count);
-                LOGC('/');
-                LOGDEC(r.total);
-                LOGC(' ');
-                LOGDEC(r.span);
-                LOGNL();
+                if (LOG_ON(LOG_DEBUG)) {
+                    LOGS("c:");
+                    LOGDEC_U32(r.sum);
+                    LOGC(' ');
+                    LOGDEC(r.count);
+                    LOGC('/');
+                    LOGDEC(r.total);
+                    LOGC(' ');
+                    LOGDEC(r.span);
+                    LOGNL();
+                }
             }
         }
     }
@@ -449,13 +740,16 @@ int main(void) {
         debug_init_trace();
     }
 
-    LOGNL();
-    LOGS("rst: ");
-    LOGHEX(rstfr);
-    LOGNL();
-    LOGS("ADR: ");
-    LOGHEX(twi_addr);
-    LOGNL();
+    if (LOG_ON(LOG_INFO)) {
+        LOGNL();
+        LOGS("rst: ");
+        LOGHEX(rstfr);
+        LOGNL();
+        LOGS("ADR: ");
+        LOGHEX(twi_addr);
+        LOGNL();
+    }
+    update_temperature();
     shutdown(SLEEP_MODE_PWR_DOWN);
     loop();
 
@@ -0,0 +1,131 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#include "noise.h"
+
+#include "util.h"
+
+/// Resolution of HX711 in bits
+#define ADC_BITS 24
+/// Fraction bits of mean
+#define MEAN_SHIFT 4
+/// Fraction bits of logarithm
+#define LOG_SHIFT 8
+
+static struct {
+    /// First sample, others are accumulated relative to it.
+    uint32_t ref;
+    /// Mean relative to ref scaled by 2^MEAN_SHIFT
+    int32_t mean;
+    /// Sum of squared deviations from mean in 1/2^MEAN_SHIFT LSB^2
+    uint32_t m2;
+    int32_t min;
+    int32_t max;
+    uint8_t n;
+    uint8_t count;
+} noise;
+
+void noise_start(uint8_t count) {
+    noise.count = count < 2 ? 2 : count;
+    noise.n = 0;
+}
+
+static int32_t clamp(int32_t v, int32_t limit) {
+    if (v > limit) {
+        return limit;
+    }
+    if (v < -limit) {
+        return -limit;
+    }
+    return v;
+}
+
+bool noise_add(uint32_t raw) {
+    if (noise.n >= noise.count) {
+        return false;
+    }
+    if (noise.n == 0) {
+        noise.ref = raw;
+        noise.mean = 0;
+        noise.m2 = 0;
+        noise.min = 0;
+        noise.max = 0;
+    }
+    int32_t x = (int32_t)(raw - noise.ref);
+    if (x < noise.min) {
+        noise.min = x;
+    }
+    if (x > noise.max) {
+        noise.max = x;
+    }
+
+    // Welford's algorithm, deviations are limited to keep products in
+    // 32 bit. Such a noisy scale fails the test anyway.
+    ++noise.n;
+    x = clamp(x, INT32_MAX >> (MEAN_SHIFT + 1)) << MEAN_SHIFT;
+    int32_t delta = clamp(x - noise.mean, INT16_MAX);
+    noise.mean += delta / noise.n;
+    int32_t delta2 = clamp(x - noise.mean, INT16_MAX);
+    int32_t sq = delta * delta2;
+    if (sq > 0) {
+        uint32_t m2 = noise.m2 + ((uint32_t)sq >> MEAN_SHIFT);
+        noise.m2 = m2 < noise.m2 ? UINT32_MAX : m2;
+    }
+
+    return noise.n == noise.count;
+}
+
+static uint16_t isqrt(uint32_t v) {
+    uint32_t r = 0;
+    for (uint32_t b = 1UL << 30; b != 0; b >>= 2) {
+        if (v >= r + b) {
+            v -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+    }
+    return r;
+}
+
+/// Logarithm to base 2 in 1/2^LOG_SHIFT of v > 0.
+static uint16_t log2_fixed(uint32_t v) {
+    uint8_t msb = 31;
+    while ((v & (1UL << 31)) == 0) {
+        v <<= 1;
+        --msb;
+    }
+    uint16_t f = (v >> (31 - LOG_SHIFT)) & ((1 << LOG_SHIFT) - 1);
+    // log2(1 + f) ~ f + 0.3466 f (1 - f), error below 0.01
+    f += (uint32_t)f * ((1 << LOG_SHIFT) - f) * 89 >> (2 * LOG_SHIFT);
+    return ((uint16_t)msb << LOG_SHIFT) + f;
+}
+
+void noise_result(uint8_t *dst) {
+    // Variance in 1/2^MEAN_SHIFT LSB^2
+    uint32_t var = noise.m2 / (noise.n > 1 ? noise.n - 1 : 1);
+
+    uint32_t mean = noise.ref + (noise.mean >> MEAN_SHIFT);
+    dst[0] = (mean >> 16) & 0xFF;
+    dst[1] = (mean >> 8) & 0xFF;
+    dst[2] = mean & 0xFF;
+
+    // Standard deviation in 1/2^MEAN_SHIFT LSB
+    uint32_t std = var < (1UL << 28) ? isqrt(var << MEAN_SHIFT) : 0xFFFF;
+    write_big_endian_u16(dst + 3, std > 0xFFFF ? 0xFFFF : std);
+
+    uint32_t pp = noise.max - noise.min;
+    write_big_endian_u16(dst + 5, pp > 0xFFFF ? 0xFFFF : pp);
+
+    // An ideal quantizer has a noise of 1/sqrt(12) LSB, so
+    // ENOB = ADC_BITS - log2(std * sqrt(12)) = ADC_BITS - log2(12 var) / 2
+    int16_t enob = (ADC_BITS + MEAN_SHIFT / 2) << LOG_SHIFT;
+    if (var != 0) {
+        enob -= log2_fixed(var < UINT32_MAX / 12 ? 12 * var : UINT32_MAX) / 2;
+    }
+    // Round to 1/8 bit, noise below the ideal quantizer counts as ADC_BITS
+    enob = (enob + (1 << (LOG_SHIFT - 4))) >> (LOG_SHIFT - 3);
+    dst[7] = enob > (ADC_BITS << 3) ? ADC_BITS << 3 : enob;
+}
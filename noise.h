@@ -0,0 +1,35 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Size of result of noise self-test.
+#define NOISE_RESULT_SIZE 8
+
+/**
+ * @brief Start noise self-test.
+ *
+ * @param count Number of raw samples to collect, at least 2
+ */
+void noise_start(uint8_t count);
+
+/**
+ * @brief Add raw HX711 sample.
+ *
+ * @return true iff this sample completed the self-test.
+ */
+bool noise_add(uint32_t raw);
+
+/**
+ * @brief Get result of self-test.
+ *
+ * Result is mean (24 bit), standard deviation in 1/16 LSB (16 bit),
+ * peak-to-peak in LSB (16 bit) and effective number of bits in 1/8 bit,
+ * all big endian.
+ */
+void noise_result(uint8_t *dst);
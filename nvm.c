@@ -5,16 +5,38 @@
 
 #include "nvm.h"
 
+#include "util.h"
+
 #include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <string.h>
 
 struct calib_data calib_data = {};
+struct valve_config valve_config;
+struct limits_config limits_config;
+struct tare_table tare_table;
+uint8_t tare_index = NVM_TARE_NONE;
 uint8_t twi_addr;
-static EEMEM struct calib_data nvm_calib_data;
-static EEMEM uint8_t nvm_twi_addr;
+static EEMEM struct nvm_layout nvm;
+
+static const __flash struct {
+    void *ram;
+    void *eeprom;
+    uint8_t size;
+} regions[NVM_REGION_COUNT] = {
+    [NVM_REGION_CALIB] = {&calib_data, &nvm.calib, sizeof(calib_data)},
+    [NVM_REGION_VALVE] = {&valve_config, &nvm.valve, sizeof(valve_config)},
+    [NVM_REGION_LIMITS] = {&limits_config, &nvm.limits, sizeof(limits_config)},
+    [NVM_REGION_TARES] = {&tare_table, &nvm.tares, sizeof(tare_table)},
+};
 
 void nvm_init(void) {
-    twi_addr = eeprom_read_byte(&nvm_twi_addr);
-    eeprom_read_block(&calib_data, &nvm_calib_data, sizeof calib_data);
+    twi_addr = eeprom_read_byte(&nvm.twi_addr);
+    eeprom_read_block(&calib_data, &nvm.calib, sizeof calib_data);
+    // Erased EEPROM selects full drive of the valve
+    eeprom_read_block(&valve_config, &nvm.valve, sizeof valve_config);
+    eeprom_read_block(&limits_config, &nvm.limits, sizeof limits_config);
+    eeprom_read_block(&tare_table, &nvm.tares, sizeof tare_table);
 
     if (twi_addr == 0xFF)
         twi_addr = 0x40;
@@ -27,9 +49,38 @@ void nvm_init(void) {
 }
 
 void nvm_write_calib_data(void) {
-    eeprom_update_block(&calib_data, &nvm_calib_data, sizeof calib_data);
+    eeprom_update_block(&calib_data, &nvm.calib, sizeof calib_data);
 }
 
 void nvm_write_twi_addr(void) {
-    eeprom_update_byte(&nvm_twi_addr, twi_addr);
+    eeprom_update_byte(&nvm.twi_addr, twi_addr);
+}
+
+bool nvm_set_region(uint8_t region, const uint8_t *data, uint8_t len) {
+    if (region >= NVM_REGION_COUNT || len < regions[region].size) {
+        return false;
+    }
+    // Region data may be read in interrupts
+    LOCKI();
+    memcpy(regions[region].ram, data, regions[region].size);
+    UNLOCKI();
+    return true;
+}
+
+bool nvm_write_region(uint8_t region) {
+    if (region >= NVM_REGION_COUNT) {
+        return false;
+    }
+    eeprom_update_block(regions[region].ram, regions[region].eeprom,
+                        regions[region].size);
+    return true;
+}
+
+bool nvm_select_tare(uint8_t index) {
+    tare_index = NVM_TARE_NONE;
+    if (index >= NVM_TARE_COUNT || tare_table.tare[index] == 0xFFFFFFFF) {
+        return index == NVM_TARE_NONE;
+    }
+    tare_index = index;
+    return true;
 }
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #pragma pack(push, 1)
@@ -14,11 +15,96 @@ struct calib_data {
         uint16_t scale;
     } hx711;
 };
+
+/// Peak-and-hold drive of the valve.
+struct valve_config {
+    /// Time of full drive after opening
+    uint16_t pull_in_ms;
+    /// Duty cycle in 1/256 after pull-in, 255 keeps full drive
+    uint8_t hold_duty;
+};
+
+/// Limits checked with every weight sample while valve or stepper is active.
+/// Erased EEPROM sets all limits to their maximum.
+struct limits_config {
+    uint32_t max_weight;
+    /// Maximum weight change in weight units per second
+    uint16_t max_rate;
+    /// Maximum time in seconds valve or stepper is active without pause
+    uint16_t max_runtime;
+};
+
+/// Number of container tare weights stored in EEPROM.
+#define NVM_TARE_COUNT 8
+/// Index selecting no tare.
+#define NVM_TARE_NONE 0xFF
+
+/// Tare weights of containers in weight units, erased entries are unused.
+struct tare_table {
+    uint32_t tare[NVM_TARE_COUNT];
+};
+
+/// Layout of the EEPROM, shared with the host tool creating EEPROM images.
+/// It replaces separate EEMEM variables of unspecified placement, so older
+/// devices need to be provisioned again.
+struct nvm_layout {
+    struct calib_data calib;
+    uint8_t twi_addr;
+    struct valve_config valve;
+    struct limits_config limits;
+    struct tare_table tares;
+};
 #pragma pack(pop)
 
+/// Regions of configuration data that can be written with paged TWI writes.
+/// The data of a region is the little endian image of its structure.
+enum {
+    NVM_REGION_CALIB = 0,
+    NVM_REGION_VALVE = 1,
+    NVM_REGION_LIMITS = 2,
+    NVM_REGION_TARES = 3,
+    NVM_REGION_COUNT,
+};
+
 extern uint8_t twi_addr;
 extern struct calib_data calib_data;
+extern struct valve_config valve_config;
+extern struct limits_config limits_config;
+extern struct tare_table tare_table;
+/// Index of selected tare or NVM_TARE_NONE.
+extern uint8_t tare_index;
+
+/// Subtract tare of selected container from weight.
+/// Weights below the tare result in negative net weights.
+static inline int32_t net_weight(uint32_t w) {
+    if (tare_index == NVM_TARE_NONE) {
+        return (int32_t)w;
+    }
+    return (int32_t)(w - tare_table.tare[tare_index]);
+}
 
 void nvm_init(void);
 void nvm_write_calib_data(void);
 void nvm_write_twi_addr(void);
+/**
+ * @brief Replace data of region in RAM.
+ *
+ * @param region Region identifier
+ * @param data New data of region
+ * @param len Number of bytes available in data
+ * @return false iff region is invalid or len is smaller than region size.
+ */
+bool nvm_set_region(uint8_t region, const uint8_t *data, uint8_t len);
+/**
+ * @brief Write region from RAM to EEPROM.
+ *
+ * @return false iff region is invalid.
+ */
+bool nvm_write_region(uint8_t region);
+/**
+ * @brief Select tare subtracted by net_weight().
+ *
+ * @param index Tare index or NVM_TARE_NONE
+ * @return false iff tare is invalid or erased, no tare is selected then.
+ */
+bool nvm_select_tare(uint8_t index);
@@ -3,12 +3,16 @@
     SPDX-License-Identifier: MIT
 */
 
+#define LOG_MODULE LOG_MOD_STEPPER
+
 #include "stepper.h"
 
 #include "config.h"
 #include "debug.h"
 #include "time.h"
+#include "timer.h"
 #include "twi.h"
+#include "util.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
@@ -21,6 +25,16 @@
 #define MINP       ((F_CPU * 38UL + DIV_US - 1) / DIV_US)
 #define MAXP       ((F_CPU * 19UL + DIV_MS - 1) / DIV_MS)
 #define STP_HIGH_P ((F_CPU * 1UL + DIV_US - 1) / DIV_US)
+/// Delay of first step after waking driver for its charge pump to stabilize.
+#define WAKE_P     ((F_CPU * 1UL + DIV_MS - 1) / DIV_MS)
+/// Delay of first step if driver is already awake.
+#define AWAKE_P    ((F_CPU * 10UL + DIV_US - 1) / DIV_US)
+/// Prescaler for measuring planning time of move.
+#define PLAN_DIV   64UL
+/// Prescaler for keep-awake timeout.
+#define IDLE_DIV   1024UL
+/// Duration of ramp up of stepper_run().
+#define RUN_RAMP   (F_CPU / CLKDIV / 10)
 
 struct {
     /// Time since start or time to end in units of CLKDIV/F_CPU seconds.
@@ -29,6 +43,10 @@ struct {
     uint32_t step;
     /// Total number of steps to take.
     uint32_t total_steps;
+    /// Absolute position at start of current move.
+    int32_t origin;
+    /// Positions are reduced modulo this number of steps if not zero.
+    uint32_t modulus;
     /// Duration of ramp up/down phase.
     uint16_t ramp;
     /// Minimum step period in timer ticks (CLKDIV/F_CPU seconds).
@@ -37,11 +55,94 @@ struct {
     uint8_t shift;
     /// Stepper direction is either 1 or -1.
     int8_t dir;
+    /// Stop when home sensor triggers.
+    bool sense;
+    /// Move was stopped by home sensor.
+    bool triggered;
+    /// Timer is counting keep-awake timeout instead of steps.
+    bool idle;
+    /// Keep-awake timeout in units of IDLE_DIV/F_CPU seconds.
+    uint16_t keep_awake;
+    /// Cycle counter runs since dispatch of command.
+    bool dispatched;
+    struct stepper_stats stats;
 } stepper;
 
+static struct {
+    uint8_t state;
+    bool dir;
+    uint8_t slow;
+    uint16_t backoff;
+} homing;
+
+static inline bool home_sensor_active(void) {
+    return (HOME_PORT.IN & HOME_BIT) == 0;
+}
+
+
+/// Keep driver awake after move until keep-awake timeout elapses.
+static inline void stepper_start_idle(void) {
+    // Disable timer
+    TCA0.SINGLE.CTRLA = 0;
+    if (stepper.keep_awake == 0) {
+        // Disable interrupt
+        TCA0.SINGLE.INTCTRL = 0;
+        // Disable stepper driver
+        STP_NSLP_PORT.OUTCLR = STP_NSLP_BIT;
+        return;
+    }
+    stepper.idle = true;
+    TCA0.SINGLE.CNT = 0;
+    TCA0.SINGLE.PER = stepper.keep_awake;
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV1024_gc | TCA_SINGLE_ENABLE_bm;
+}
+
+#if ENABLE_STEP_MONITOR
+/// Update statistics after next period was set.
+static inline void stepper_monitor(uint16_t delay) {
+    struct stepper_stats *stats = &stepper.stats;
+    // Timer wrapped since interrupt entry, new period missed its update.
+    if (TCA0.SINGLE.CNT < delay && stats->late != 0xFFFF) {
+        ++stats->late;
+    }
+    if (delay > stats->max_delay) {
+        stats->max_delay = delay;
+    }
+    uint16_t bin = delay >> STEPPER_DELAY_SHIFT;
+    uint16_t *count = &stats->delays[bin < STEPPER_DELAY_BINS
+                                         ? bin
+                                         : STEPPER_DELAY_BINS - 1];
+    if (*count != 0xFFFF) {
+        ++*count;
+    }
+}
+#endif
 
 ISR(TCA0_OVF_vect) {
-    STP_STEP_PORT.OUTSET = STP_STEP_BIT;
+#if ENABLE_STEP_MONITOR
+    // Delay since overflow including interrupt response and prologue.
+    uint16_t delay = TCA0.SINGLE.CNT;
+#endif
+    if (stepper.idle) {
+        // Keep-awake timeout elapsed
+        stepper.idle = false;
+        TCA0.SINGLE.INTCTRL = 0;
+        TCA0.SINGLE.CTRLA = 0;
+        STP_NSLP_PORT.OUTCLR = STP_NSLP_BIT;
+        TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+        return;
+    }
+
+    // Stop at exact step where home sensor triggers.
+    if (stepper.sense && home_sensor_active()) {
+        stepper.sense = false;
+        stepper.triggered = true;
+        stepper.total_steps = stepper.step;
+    }
+    // Only pulse for counted steps to keep absolute position exact.
+    if (stepper.step < stepper.total_steps) {
+        STP_STEP_PORT.OUTSET = STP_STEP_BIT;
+    }
     // period for next step
     uint16_t p = stepper.minp;
     uint32_t t = stepper.t >> stepper.shift;
@@ -56,24 +157,25 @@ ISR(TCA0_OVF_vect) {
     // Are total steps reached?
     if (stepper.step < stepper.total_steps) {
         TCA0.SINGLE.PERBUF = p;
+#if ENABLE_STEP_MONITOR
+        stepper_monitor(delay);
+#endif
         ++stepper.step;
 
         // increase t in first half and decrease it in second half
         int32_t mid = stepper.total_steps / 2;
         if (stepper.step + 1 < mid) {
-            stepper.t += p;
+            // Saturate for endless runs
+            if (stepper.t <= UINT32_MAX - p) {
+                stepper.t += p;
+            }
         } else if (stepper.t > p) {
             stepper.t -= p;
         } else {
             stepper.t = 0;
         }
     } else {
-        // Disable interrupt
-        TCA0.SINGLE.INTCTRL = 0;
-        // Disable timer
-        TCA0.SINGLE.CTRLA = 0;
-        // Disable stepper driver
-        STP_NSLP_PORT.OUTCLR = STP_NSLP_BIT;
+        stepper_start_idle();
     }
     // Clear interrupt flag
     TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
@@ -95,6 +197,12 @@ static uint32_t stepper_period(uint32_t x) {
     return ((x2 * x2) >> 16) + stepper.minp;
 }
 
+#if ENABLE_BENCH
+uint32_t stepper_bench_period(uint32_t x) {
+    return stepper_period(x);
+}
+#endif
+
 static void stepper_calc_shift_ramp(uint32_t r) {
     uint8_t s = 0;
     for (;;) {
@@ -111,9 +219,74 @@ static void stepper_calc_shift_ramp(uint32_t r) {
     stepper.shift = s;
 }
 
+/// Absolute position without applying modulus.
+static int32_t stepper_raw_position(void) {
+    LOCKI();
+    uint32_t step = stepper.step;
+    UNLOCKI();
+    return stepper.dir > 0 ? stepper.origin + (int32_t)step
+                           : stepper.origin - (int32_t)step;
+}
+
+static int32_t stepper_reduce(int32_t pos) {
+    if (stepper.modulus != 0) {
+        pos %= (int32_t)stepper.modulus;
+        if (pos < 0) {
+            pos += stepper.modulus;
+        }
+    }
+    return pos;
+}
+
 void stepper_rotate(bool dir, uint8_t cycles, uint8_t maxspd) {
+    stepper_move(dir, (uint32_t)cycles << (3 + 4), maxspd);
+}
 
-    stepper_stop();
+static void stepper_halt(void) {
+    stepper.idle = false;
+    // Disable interrupt
+    TCA0.SINGLE.INTCTRL = 0;
+    // Disable timer
+    TCA0.SINGLE.CTRLA = 0;
+    // Put driver to sleep
+    STP_NSLP_PORT.OUTCLR = STP_NSLP_BIT;
+    // Set step pin to defined level
+    STP_STEP_PORT.OUTCLR = STP_STEP_BIT;
+}
+
+/**
+ * @brief Stop timer and continue counting from where last move stopped.
+ *
+ * The driver is left awake, so a move started right after continues
+ * without delay. Calling it again keeps the position.
+ *
+ * @return true iff driver is still awake.
+ */
+static bool stepper_freeze(void) {
+    bool awake = (STP_NSLP_PORT.OUT & STP_NSLP_BIT) != 0;
+
+    // Disable interrupt and timer, but leave driver awake
+    TCA0.SINGLE.INTCTRL = 0;
+    TCA0.SINGLE.CTRLA = 0;
+    stepper.idle = false;
+
+    stepper.origin = stepper_reduce(stepper_raw_position());
+    stepper.step = 0;
+    return awake;
+}
+
+/// Freeze position and set direction of next move.
+static bool stepper_prepare(bool dir) {
+    bool awake = stepper_freeze();
+    stepper.dir = dir ? 1 : -1;
+    return awake;
+}
+
+/// Measure time for planning the move with TCA0.
+static void stepper_start_plan(bool dir) {
+    TCA0.SINGLE.CNT = 0;
+    TCA0.SINGLE.PER = 0xFFFF;
+    TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV64_gc | TCA_SINGLE_ENABLE_bm;
 
     if (dir) {
         STP_DIR_PORT.OUTSET = STP_DIR_BIT;
@@ -123,19 +296,75 @@ void stepper_rotate(bool dir, uint8_t cycles, uint8_t maxspd) {
 
     // Enable stepper driver
     STP_NSLP_PORT.OUTSET = STP_NSLP_BIT;
+}
+
+/// Start stepping after planning the move.
+static void stepper_launch(bool awake) {
+    uint32_t plan = TCA0.SINGLE.CNT * PLAN_DIV / CLKDIV;
+    TCA0.SINGLE.CTRLA = 0;
+
+    // If driver was asleep, delay first step pulse to 1ms after wake up in
+    // order to allow stepper driver charge pump to stabalize.
+    uint16_t first = AWAKE_P;
+    if (!awake && plan + AWAKE_P < WAKE_P) {
+        first = WAKE_P - plan;
+    }
+    uint32_t latency = first * 1000UL / (F_CPU / DIV_MS);
+    if (stepper.dispatched) {
+        stepper.dispatched = false;
+        latency += timer_cycles_to_us(timer_cycles_stop());
+    } else {
+        latency += plan * 1000UL / (F_CPU / DIV_MS);
+    }
+    stepper.stats = (struct stepper_stats){
+        .latency_us = latency > 0xFFFF ? 0xFFFF : latency,
+        .awake = awake,
+    };
 
-    TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
     TCA0.SINGLE.CNT = 0;
     TCA0.SINGLE.CMP0 = STP_HIGH_P;
-
-    // Set initial period to 1ms for first step pulse in order to
-    // allow stepper driver charge pump to stabalize.
+    TCA0.SINGLE.PER = first;
+    // Period of second step is start of ramp.
     // Subsequent timer periods are calculated in interrupt.
-    TCA0.SINGLE.PERBUF = ((F_CPU * 1UL + DIV_MS - 1) / DIV_MS);
+    TCA0.SINGLE.PERBUF = stepper_period(stepper.ramp);
+    TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+    TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
 
-    stepper.step = 0;
-    stepper.dir = dir ? 1 : -1;
-    stepper.total_steps = cycles << (3 + 4);
+    // Start TCA0
+    TCA0.SINGLE.CTRLA = TCA_CLKSEL | TCA_SINGLE_ENABLE_bm;
+
+    if (LOG_ON(LOG_DEBUG)) {
+        LOGS("L:");
+        LOGDEC_U16(stepper.stats.latency_us);
+        LOGNL();
+    }
+}
+
+void stepper_begin_command(void) {
+    stepper.dispatched = timer_cycles_start();
+}
+
+void stepper_end_command(void) {
+    if (stepper.dispatched) {
+        stepper.dispatched = false;
+        timer_cycles_stop();
+    }
+}
+
+void stepper_move(bool dir, uint32_t steps, uint8_t maxspd) {
+    bool awake = stepper_prepare(dir);
+
+    if (steps == 0) {
+        if (awake) {
+            TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
+            stepper_start_idle();
+        }
+        return;
+    }
+
+    stepper_start_plan(dir);
+
+    stepper.total_steps = steps;
 
     // Minimum period in microseconds
     uint32_t minpt = 38UL * (255UL + 16UL) / (maxspd + 16UL);
@@ -167,36 +396,204 @@ void stepper_rotate(bool dir, uint8_t cycles, uint8_t maxspd) {
     r = rt + stepper.minp * (stepper.total_steps / 2 - rs);
     stepper_calc_shift_ramp(r);
 
-    LOGS("R:");
-    LOGDEC_U16(stepper.ramp);
-    LOGS(" S:");
-    LOGDEC(stepper.shift);
-    LOGS(" P:");
-    LOGDEC_U16(stepper.minp);
-    LOGNL();
+    if (LOG_ON(LOG_DEBUG)) {
+        LOGS("R:");
+        LOGDEC_U16(stepper.ramp);
+        LOGS(" S:");
+        LOGDEC(stepper.shift);
+        LOGS(" P:");
+        LOGDEC_U16(stepper.minp);
+        LOGNL();
+    }
 
-    // Start TCA0
-    TCA0.SINGLE.CTRLA = TCA_CLKSEL | TCA_SINGLE_ENABLE_bm;
+    stepper_launch(awake);
+}
+
+/// Step period in timer ticks for given speed in steps per second.
+static uint16_t stepper_speed_period(uint16_t sps) {
+    uint32_t p = F_CPU / CLKDIV / (sps != 0 ? sps : 1);
+    if (p < MINP) {
+        p = MINP;
+    }
+    return p > 0xFFFF ? 0xFFFF : p;
+}
+
+void stepper_run(bool dir, uint16_t sps) {
+    bool awake = stepper_prepare(dir);
+    stepper_start_plan(dir);
+
+    // Ramp up like stepper_move(), but never down.
+    stepper.total_steps = UINT32_MAX;
+    stepper.minp = stepper_speed_period(sps);
+    stepper.ramp = 0;
+    stepper.shift = 0;
+    stepper.t = 0;
+    // Slow speeds need no ramp, and no ramp fits below MAXP.
+    if (stepper.minp < MAXP) {
+        stepper_calc_shift_ramp(RUN_RAMP);
+    }
+
+    stepper_launch(awake);
+}
+
+void stepper_set_speed(uint16_t sps) {
+    uint16_t p = stepper_speed_period(sps);
+    LOCKI();
+    stepper.minp = p;
+    UNLOCKI();
+}
+
+static void home_finish(uint8_t state) {
+    stepper.sense = false;
+    homing.state = state;
+    // Disable pull-up and digital input of sensor pin
+    HOME_PINCTRL = PORT_ISC_INPUT_DISABLE_gc;
 }
 
 void stepper_stop(void)
 {
-    // Disable interrupt
-    TCA0.SINGLE.INTCTRL = 0;
-    // Disable timer
-    TCA0.SINGLE.CTRLA = 0;
-    // Put driver to sleep
-    STP_NSLP_PORT.OUTCLR = STP_NSLP_BIT;
-    // Set step pin to defined level
-    STP_STEP_PORT.OUTCLR = STP_STEP_BIT;
+    stepper_halt();
+    stepper.sense = false;
+    if (homing.state > STEPPER_HOME_IDLE && homing.state < STEPPER_HOME_DONE) {
+        // Abort homing
+        home_finish(STEPPER_HOME_FAILED);
+    }
 }
 
 bool stepper_is_running(void)
 {
-    return TCA0.SINGLE.CTRLA != 0;
+    return TCA0.SINGLE.CTRLA != 0 && !stepper.idle;
 }
 
 uint8_t stepper_get_cycle(void)
 {
     return (uint8_t)(stepper.step >> 3);
 }
+
+bool stepper_move_to(int32_t pos, uint8_t maxspd) {
+    // Stop at the position the distance is computed from.
+    stepper_freeze();
+    // Unsigned arithmetic wraps instead of overflowing.
+    uint32_t delta = (uint32_t)stepper_reduce(pos) - (uint32_t)stepper.origin;
+    if (stepper.modulus != 0) {
+        // take shorter way around
+        int32_t half = stepper.modulus / 2;
+        if ((int32_t)delta > half) {
+            delta -= stepper.modulus;
+        } else if ((int32_t)delta < -half) {
+            delta += stepper.modulus;
+        }
+    }
+
+    bool dir = (int32_t)delta >= 0;
+    uint32_t steps = dir ? delta : 0 - delta;
+    if (steps > STEPPER_MAX_STEPS) {
+        stepper_stop();
+        return false;
+    }
+    stepper_move(dir, steps, maxspd);
+    return true;
+}
+
+int32_t stepper_get_position(void) {
+    return stepper_reduce(stepper_raw_position());
+}
+
+static void stepper_define_position(int32_t pos) {
+    LOCKI();
+    stepper.origin = pos;
+    stepper.step = 0;
+    UNLOCKI();
+}
+
+void stepper_set_position(int32_t pos) {
+    stepper_stop();
+    stepper_define_position(pos);
+}
+
+bool stepper_set_modulus(uint32_t modulus) {
+    // Positions are signed and reduced with signed arithmetic.
+    if (modulus > INT32_MAX) {
+        return false;
+    }
+    stepper.modulus = modulus;
+    return true;
+}
+
+static void home_seek(bool dir, uint32_t steps, uint8_t maxspd) {
+    stepper.triggered = false;
+    stepper.sense = true;
+    stepper_move(dir, steps, maxspd);
+}
+
+void stepper_home(bool dir, uint8_t fast, uint8_t slow, uint16_t backoff,
+                  uint16_t travel) {
+    stepper_stop();
+    homing.dir = dir;
+    homing.slow = slow;
+    homing.backoff = backoff;
+    homing.state = STEPPER_HOME_FAST;
+    // Enable digital input with pull-up on sensor pin
+    HOME_PINCTRL = PORT_ISC_INTDISABLE_gc | PORT_PULLUPEN_bm;
+    home_seek(dir, travel, fast);
+}
+
+bool stepper_home_pending(void) {
+    return homing.state > STEPPER_HOME_IDLE &&
+           homing.state < STEPPER_HOME_DONE && !stepper_is_running();
+}
+
+void stepper_home_update(void) {
+    if (!stepper_home_pending()) {
+        return;
+    }
+
+    switch (homing.state) {
+    case STEPPER_HOME_FAST:
+        if (!stepper.triggered) {
+            home_finish(STEPPER_HOME_FAILED);
+            break;
+        }
+        homing.state = STEPPER_HOME_BACKOFF;
+        stepper_move(!homing.dir, homing.backoff, homing.slow);
+        break;
+    case STEPPER_HOME_BACKOFF:
+        if (home_sensor_active()) {
+            // Back off distance too short
+            home_finish(STEPPER_HOME_FAILED);
+            break;
+        }
+        homing.state = STEPPER_HOME_SLOW;
+        home_seek(homing.dir, 2UL * homing.backoff + 1, homing.slow);
+        break;
+    case STEPPER_HOME_SLOW:
+        if (!stepper.triggered) {
+            home_finish(STEPPER_HOME_FAILED);
+            break;
+        }
+        stepper_define_position(0);
+        home_finish(STEPPER_HOME_DONE);
+        break;
+    }
+
+    if (LOG_ON(LOG_INFO)) {
+        LOGS("H:");
+        LOGDEC(homing.state);
+        LOGNL();
+    }
+}
+
+uint8_t stepper_home_state(void) {
+    return homing.state;
+}
+
+void stepper_set_keep_awake(uint16_t ms) {
+    uint32_t t = ms * (F_CPU / IDLE_DIV) / 1000UL;
+    stepper.keep_awake = t > 0xFFFF ? 0xFFFF : t;
+}
+
+void stepper_get_stats(struct stepper_stats *stats) {
+    LOCKI();
+    *stats = stepper.stats;
+    UNLOCKI();
+}
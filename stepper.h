@@ -8,6 +8,27 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/// Number of bins of step interrupt delay histogram.
+#define STEPPER_DELAY_BINS 4
+/// Width of histogram bins is 2^STEPPER_DELAY_SHIFT timer ticks.
+#define STEPPER_DELAY_SHIFT 5
+
+/// Statistics of last or current move.
+struct stepper_stats {
+    /// Time from dispatch of command of last move until its first step in
+    /// microseconds. Counted from start of planning if TCB0 was in use.
+    uint16_t latency_us;
+    /// Driver was already awake at start of last move.
+    bool awake;
+    /// Maximum delay of step interrupt after timer overflow in timer ticks.
+    uint16_t max_delay;
+    /// Number of steps whose next period was set after the timer overflowed
+    /// again, which stretches the step sequence.
+    uint16_t late;
+    /// Histogram of step interrupt delays, last bin counts all larger delays.
+    uint16_t delays[STEPPER_DELAY_BINS];
+};
+
 void stepper_init(void);
 /**
  * @brief Start stepper motor.
@@ -18,6 +39,136 @@ void stepper_init(void);
  */
 void stepper_rotate(bool dir, uint8_t cycles, uint8_t maxspd);
 
+/// Maximum number of steps of a single move.
+#define STEPPER_MAX_STEPS 0x10000UL
+
+/**
+ * @brief Start move by given number of steps.
+ *
+ * @param dir Direction of rotation
+ * @param steps Number of steps, at most STEPPER_MAX_STEPS
+ * @param maxspd maximum speed to ramp up to
+ */
+void stepper_move(bool dir, uint32_t steps, uint8_t maxspd);
+
+/**
+ * @brief Start measuring latency of next move at dispatch of its command.
+ *
+ * Claims the cycle counter until the move starts or stepper_end_command().
+ */
+void stepper_begin_command(void);
+void stepper_end_command(void);
+
+/**
+ * @brief Run at constant speed until stopped.
+ *
+ * Speed ramps up within about 100ms.
+ *
+ * @param dir Direction of rotation
+ * @param sps Speed in steps per second
+ */
+void stepper_run(bool dir, uint16_t sps);
+
+/**
+ * @brief Change speed of running stepper_run().
+ *
+ * Takes effect with the next step.
+ *
+ * @param sps Speed in steps per second
+ */
+void stepper_set_speed(uint16_t sps);
+
+/**
+ * @brief Start move to absolute position.
+ *
+ * If a modulus is set, the shorter direction is taken.
+ *
+ * @param pos Target position in steps
+ * @param maxspd maximum speed to ramp up to
+ * @return false iff distance to target exceeds STEPPER_MAX_STEPS, the
+ *         stepper is stopped then.
+ */
+bool stepper_move_to(int32_t pos, uint8_t maxspd);
+
+/**
+ * @brief Get absolute position.
+ *
+ * @return Position in steps, reduced to [0, modulus) if modulus is set.
+ */
+int32_t stepper_get_position(void);
+
+/**
+ * @brief Define current position.
+ *
+ * Stops any running rotation.
+ */
+void stepper_set_position(int32_t pos);
+
+/**
+ * @brief Set number of steps of one revolution of a rotary axis.
+ *
+ * @param modulus Steps per revolution or zero for a linear axis.
+ * @return false iff modulus exceeds INT32_MAX, it is unchanged then.
+ */
+bool stepper_set_modulus(uint32_t modulus);
+
+/**
+ * @brief Set time the driver is kept awake after a move.
+ *
+ * A move started within this time skips the wake up delay of the driver.
+ *
+ * @param ms Keep-awake time in milliseconds, zero to sleep immediately.
+ */
+void stepper_set_keep_awake(uint16_t ms);
+
+/**
+ * @brief Get statistics of last move.
+ */
+void stepper_get_stats(struct stepper_stats *stats);
+
+/// States of homing procedure.
+enum {
+    STEPPER_HOME_IDLE,
+    STEPPER_HOME_FAST,
+    STEPPER_HOME_BACKOFF,
+    STEPPER_HOME_SLOW,
+    STEPPER_HOME_DONE,
+    STEPPER_HOME_FAILED,
+};
+
+/**
+ * @brief Start homing procedure.
+ *
+ * Approaches home sensor with fast speed, backs off and approaches again
+ * with slow speed. The position where the sensor triggers is defined as
+ * position zero. Progress is made by calling stepper_home_update().
+ *
+ * @param dir Direction towards sensor
+ * @param fast Speed of first approach
+ * @param slow Speed of back off and second approach
+ * @param backoff Number of steps to back off after first approach
+ * @param travel Maximum number of steps of first approach. The speed profile
+ *               is planned for this distance, so it should not be much
+ *               longer than the actual distance to the sensor.
+ */
+void stepper_home(bool dir, uint8_t fast, uint8_t slow, uint16_t backoff,
+                  uint16_t travel);
+
+/**
+ * @brief Check whether homing procedure waits for stepper_home_update().
+ */
+bool stepper_home_pending(void);
+
+/**
+ * @brief Start next phase of homing procedure after previous move stopped.
+ */
+void stepper_home_update(void);
+
+/**
+ * @brief Get state of homing procedure.
+ */
+uint8_t stepper_home_state(void);
+
 /**
  * @brief Stop any running rotation.
  */
@@ -36,3 +187,8 @@ bool stepper_is_running(void);
  * @return Current number of full steps done.
  */
 uint8_t stepper_get_cycle(void);
+
+#if ENABLE_BENCH
+/// Benchmark hook, calculate step period at given ramp position.
+uint32_t stepper_bench_period(uint32_t x);
+#endif
@@ -6,6 +6,7 @@
 #include "timer.h"
 
 #include "debug.h"
+#include "util.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
@@ -22,6 +23,8 @@ void timer_init(void) {
 
     RTC.PER = 0xffff;
     RTC.CLKSEL = RTC_CLKSEL_INT32K_gc;
+    // PIT keeps running, so ticks need no synchronization in interrupts.
+    RTC.PITCTRLA = RTC_PERIOD_CYC32_gc | RTC_PITEN_bm;
 }
 
 void timer_start(void) {
@@ -33,6 +36,7 @@ void timer_start(void) {
 }
 
 void timer_stop(void) {
+    timer_clear_alarm();
     wait_while(RTC_CTRLABUSY_bm);
     RTC.CTRLA = 0;
 }
@@ -41,6 +45,112 @@ uint16_t timer_get_time(void) {
     return RTC.CNT;
 }
 
+static volatile bool alarm;
+
+ISR(RTC_CNT_vect) {
+    RTC.INTFLAGS = RTC_CMP_bm;
+    RTC.INTCTRL = 0;
+    alarm = true;
+}
+
+void timer_set_alarm(uint16_t time) {
+    wait_while(RTC_CMPBUSY_bm);
+    RTC.CMP = time;
+    RTC.INTFLAGS = RTC_CMP_bm;
+    RTC.INTCTRL = RTC_CMP_bm;
+}
+
+void timer_clear_alarm(void) {
+    RTC.INTCTRL = 0;
+    RTC.INTFLAGS = RTC_CMP_bm;
+    alarm = false;
+}
+
+bool timer_alarm_pending(void) {
+    return alarm;
+}
+
+void timer_alarm_acknowledge(void) {
+    alarm = false;
+}
+
+/// Enable periodic interrupt RTC_PIT_vect with period of about 1ms.
+/// The first tick follows within one period.
+void timer_tick_start(void) {
+    RTC.PITINTFLAGS = RTC_PI_bm;
+    RTC.PITINTCTRL = RTC_PI_bm;
+}
+
+void timer_tick_stop(void) {
+    RTC.PITINTCTRL = 0;
+}
+
+static volatile uint8_t tcb_owner = TIMER_TCB_FREE;
+
+bool timer_tcb_claim(uint8_t owner) {
+    LOCKI();
+    bool ok = tcb_owner == TIMER_TCB_FREE;
+    if (ok) {
+        tcb_owner = owner;
+    }
+    UNLOCKI();
+    return ok;
+}
+
+void timer_tcb_release(uint8_t owner) {
+    LOCKI();
+    if (tcb_owner == owner) {
+        TCB0.CTRLA = 0;
+        TCB0.INTCTRL = 0;
+        TCB0.INTFLAGS = TCB_CAPT_bm;
+        tcb_owner = TIMER_TCB_FREE;
+    }
+    UNLOCKI();
+}
+
+uint8_t timer_tcb_owner(void) {
+    return tcb_owner;
+}
+
+static bool cycles_start(uint8_t clksel) {
+    if (!timer_tcb_claim(TIMER_TCB_CYCLES)) {
+        return false;
+    }
+    TCB0.CTRLB = TCB_CNTMODE_INT_gc;
+    TCB0.CCMP = 0xFFFF;
+    TCB0.CNT = 0;
+    // Capture flag marks overflow, interrupt stays disabled.
+    TCB0.INTCTRL = 0;
+    TCB0.INTFLAGS = TCB_CAPT_bm;
+    TCB0.CTRLA = clksel | TCB_ENABLE_bm;
+    return true;
+}
+
+bool timer_cycles_start(void) {
+    return cycles_start(TCB_CLKSEL_CLKDIV2_gc);
+}
+
+bool timer_cycles_start_cpu(void) {
+    return cycles_start(TCB_CLKSEL_CLKDIV1_gc);
+}
+
+uint16_t timer_cycles_stop(void) {
+    if (tcb_owner != TIMER_TCB_CYCLES) {
+        return 0xFFFF;
+    }
+    uint16_t ticks = TCB0.CNT;
+    if ((TCB0.INTFLAGS & TCB_CAPT_bm) != 0) {
+        ticks = 0xFFFF;
+    }
+    timer_tcb_release(TIMER_TCB_CYCLES);
+    return ticks;
+}
+
+uint16_t timer_cycles_to_us(uint16_t ticks) {
+    uint32_t us = ticks * 1000UL / TIMER_CYCLES_PER_MS;
+    return us > 0xFFFF ? 0xFFFF : us;
+}
+
 uint8_t timer_get_time_ms(void) {
     uint16_t t = RTC.CNT;
     return t * 250U / 256;
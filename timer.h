@@ -3,10 +3,79 @@
     SPDX-License-Identifier: MIT
 */
 
+#pragma once
+
+#include <stdbool.h>
 #include <stdint.h>
 
+/// Cycle counter ticks per millisecond.
+#define TIMER_CYCLES_PER_MS (F_CPU / 2000UL)
+
 void timer_init(void);
 void timer_start(void);
 void timer_stop(void);
 uint16_t timer_get_time(void);
+/**
+ * @brief Wake main loop once RTC reaches time.
+ *
+ * The alarm only fires while the RTC runs, see timer_start().
+ *
+ * @param time Time in RTC ticks of 1/1024s
+ */
+void timer_set_alarm(uint16_t time);
+void timer_clear_alarm(void);
+bool timer_alarm_pending(void);
+void timer_alarm_acknowledge(void);
 uint8_t timer_get_time_ms(void);
+void timer_tick_start(void);
+void timer_tick_stop(void);
+
+/// Users of TCB0, which is shared by the modules below.
+enum timer_tcb_owner {
+    TIMER_TCB_FREE,
+    /// Software PWM of the valve
+    TIMER_TCB_VALVE,
+    /// Powerdown timer of the HX711
+    TIMER_TCB_HX711,
+    /// Cycle counter of timer_cycles_start()
+    TIMER_TCB_CYCLES,
+};
+
+/**
+ * @brief Claim TCB0 for owner.
+ *
+ * Safe to call from interrupts. The owner configures and starts TCB0 only
+ * after a successful claim.
+ *
+ * @return false iff TCB0 is already claimed.
+ */
+bool timer_tcb_claim(uint8_t owner);
+/// Stop TCB0 and release it, if it is claimed by owner.
+void timer_tcb_release(uint8_t owner);
+/// Current owner of TCB0.
+uint8_t timer_tcb_owner(void);
+/**
+ * @brief Start TCB0 as cycle counter with CLKDIV2 if it is unused.
+ *
+ * Claims TCB0 for TIMER_TCB_CYCLES until timer_cycles_stop().
+ *
+ * @return false iff TCB0 is in use.
+ */
+bool timer_cycles_start(void);
+/**
+ * @brief Start TCB0 as cycle counter with CPU clock if it is unused.
+ *
+ * The counter wraps after 0xFFFF cycles, TCB0.CNT can be read directly.
+ *
+ * @return false iff TCB0 is in use.
+ */
+bool timer_cycles_start_cpu(void);
+/**
+ * @brief Stop cycle counter and release TCB0.
+ *
+ * @return Elapsed ticks, saturated at 0xFFFF, also if the counter was not
+ *         running.
+ */
+uint16_t timer_cycles_stop(void);
+/// Convert ticks of cycle counter to microseconds.
+uint16_t timer_cycles_to_us(uint16_t ticks);
@@ -0,0 +1,155 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+// Verification and throughput benchmark of the host bucket filter.
+//
+// Generates synthetic sessions, checks the result of the host filter after
+// every sample against buckets.c compiled for the host and measures the
+// throughput of filter_sessions() in sessions per second.
+
+#include "bucketfilter.h"
+
+extern "C" {
+#include "../buckets.h"
+}
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using bucketfilter::Result;
+using bucketfilter::Session;
+
+struct Options {
+    size_t sessions = 100000;
+    size_t length = 64;
+    size_t verify = 2000;
+    unsigned threads = 0;
+    uint8_t min_shift = 1;
+};
+
+/// Weights around a random level with noise of random magnitude, outliers
+/// and occasional drift, like pouring or vibration during a measurement.
+std::vector<uint32_t> make_session(std::mt19937 &rng, size_t length) {
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    std::normal_distribution<double> gauss(0.0, 1.0);
+    double level = uni(rng) * 2e6;
+    double sd = std::pow(2.0, uni(rng) * 16);
+    double drift = uni(rng) < 0.2 ? gauss(rng) * sd : 0.0;
+    std::vector<uint32_t> s(length);
+    for (size_t i = 0; i < length; ++i) {
+        double v = level + drift * i + gauss(rng) * sd;
+        if (uni(rng) < 0.05) {
+            v += (uni(rng) < 0.5 ? -1 : 1) * sd * 50;
+        }
+        s[i] = uint32_t(int64_t(v));
+    }
+    return s;
+}
+
+bool verify(std::mt19937 &rng, const Options &opt) {
+    std::uniform_int_distribution<size_t> len(1, 300);
+    std::vector<Result> series;
+    for (size_t n = 0; n < opt.verify; ++n) {
+        std::vector<uint32_t> s = make_session(rng, len(rng));
+        series.resize(s.size());
+        bucketfilter::filter_session({s.data(), s.size()}, opt.min_shift,
+                                     series.data());
+        buckets_init(opt.min_shift);
+        buckets_reset();
+        for (size_t i = 0; i < s.size(); ++i) {
+            buckets_add(s[i]);
+            accu_t a = buckets_filter();
+            Result r = {a.sum, a.count, a.total, a.span};
+            if (r != series[i]) {
+                fprintf(stderr,
+                        "session %zu sample %zu: firmware %u/%u/%u/0x%02x, "
+                        "host %u/%u/%u/0x%02x\n",
+                        n, i, r.sum, r.count, r.total, r.span, series[i].sum,
+                        series[i].count, series[i].total, series[i].span);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+double run(const std::vector<Session> &sessions, std::vector<Result> &out,
+           const Options &opt, unsigned threads) {
+    auto t0 = std::chrono::steady_clock::now();
+    bucketfilter::filter_sessions(sessions.data(), sessions.size(),
+                                  out.data(), opt.min_shift, threads);
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+    return sessions.size() / t.count();
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n N          number of sessions (default: 100000)\n"
+            "  -l N          samples per session (default: 64)\n"
+            "  -v N          sessions verified against buckets.c "
+            "(default: 2000)\n"
+            "  -t N          threads (default: all cores)\n"
+            "  -s N          minimum shift (default: 1)\n",
+            prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if (a == "-n" && has_arg) {
+            opt.sessions = strtoul(argv[++i], nullptr, 0);
+        } else if (a == "-l" && has_arg) {
+            opt.length = strtoul(argv[++i], nullptr, 0);
+        } else if (a == "-v" && has_arg) {
+            opt.verify = strtoul(argv[++i], nullptr, 0);
+        } else if (a == "-t" && has_arg) {
+            opt.threads = strtoul(argv[++i], nullptr, 0);
+        } else if (a == "-s" && has_arg) {
+            opt.min_shift = strtoul(argv[++i], nullptr, 0);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937 rng(1);
+    if (!verify(rng, opt)) {
+        return 1;
+    }
+    printf("verified %zu sessions against buckets.c\n", opt.verify);
+
+    std::vector<std::vector<uint32_t>> data(opt.sessions);
+    std::vector<Session> sessions(opt.sessions);
+    for (size_t i = 0; i < opt.sessions; ++i) {
+        data[i] = make_session(rng, opt.length);
+        sessions[i] = {data[i].data(), data[i].size()};
+    }
+    std::vector<Result> out(opt.sessions);
+
+    unsigned threads = opt.threads ? opt.threads
+                                   : std::thread::hardware_concurrency();
+    double single = run(sessions, out, opt, 1);
+    printf("1 thread: %.0f sessions/s, %.1f Msamples/s\n", single,
+           single * opt.length / 1e6);
+    if (threads > 1) {
+        double multi = run(sessions, out, opt, threads);
+        printf("%u threads: %.0f sessions/s, %.1f Msamples/s\n", threads,
+               multi, multi * opt.length / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#include "bucketfilter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace bucketfilter {
+
+namespace {
+
+/// Resolution of position of values within their bucket, as in buckets.c.
+constexpr int FRAC_BITS = 8;
+/// Bits of Result::span holding the span, BUCKETS_SPAN_BITS of buckets.h.
+constexpr int SPAN_BITS = 4;
+
+// All buckets are processed at once with vectors of the compiler, which are
+// mapped to SSE, AVX or NEON as available. Lanes above BUCKET_COUNT stay
+// empty.
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+typedef int32_t i32x16 __attribute__((vector_size(64)));
+
+static_assert(BUCKET_COUNT <= 16, "Buckets must fit into vectors");
+
+/// Sessions are handed to threads in chunks of this size.
+constexpr size_t CHUNK = 64;
+
+} // namespace
+
+void Filter::reset() {
+    memset(frac_, 0, sizeof(frac_));
+    memset(count_, 0, sizeof(count_));
+    shift_ = 0;
+    lower_ = 0;
+    upper_ = 0;
+}
+
+void Filter::move(int dst, int src, bool upper) {
+    uint32_t f = frac_[src];
+    if (upper) {
+        f += uint32_t(count_[src]) << FRAC_BITS;
+    }
+    frac_[dst] = f >> 1;
+    count_[dst] = count_[src];
+}
+
+void Filter::merge(int dst, int src0) {
+    uint32_t f = uint32_t(frac_[src0]) + frac_[src0 + 1] +
+                 (uint32_t(count_[src0 + 1]) << FRAC_BITS);
+    frac_[dst] = f >> 1;
+    count_[dst] = count_[src0] + count_[src0 + 1];
+}
+
+void Filter::deflate() {
+    for (int i = 0, j = 0; i + 1 < upper_; ++j, i += 2) {
+        merge(j, i);
+    }
+    if ((upper_ & 0x1) != 0) {
+        int i = upper_ - 1;
+        move(i >> 1, i, false);
+    }
+    for (int i = BUCKET_COUNT - 1, j = i; i - 1 >= lower_; --j, i -= 2) {
+        merge(j, i - 1);
+    }
+    if ((lower_ & 0x1) != 0) {
+        int i = lower_;
+        move((BUCKET_COUNT + i) >> 1, i, true);
+    }
+
+    ++shift_;
+    int i = (upper_ + 1) >> 1;
+    int j = (BUCKET_COUNT + lower_) >> 1;
+    memset(frac_ + i, 0, sizeof(frac_[0]) * (j - i));
+    memset(count_ + i, 0, sizeof(count_[0]) * (j - i));
+    upper_ = i;
+    lower_ = j;
+}
+
+void Filter::add(uint32_t val) {
+    if (upper_ == 0) {
+        shift_ = min_shift_;
+        base_ = val;
+        upper_ = 1;
+        lower_ = BUCKET_COUNT;
+    }
+
+    // Wraps like the 32 bit subtraction of the firmware.
+    int32_t d = int32_t(val - base_);
+    int32_t k;
+    for (;;) {
+        k = d >> shift_;
+        if ((k < 0 && k + BUCKET_COUNT >= upper_) || (k >= 0 && k < lower_)) {
+            break;
+        }
+        deflate();
+    }
+
+    uint32_t pos = uint32_t(d) & ((uint32_t(1) << shift_) - 1);
+    if (shift_ <= FRAC_BITS) {
+        pos <<= FRAC_BITS - shift_;
+    } else {
+        pos >>= shift_ - FRAC_BITS;
+    }
+
+    int i = k;
+    if (i < 0) {
+        i += BUCKET_COUNT;
+        if (i < lower_) {
+            lower_ = i;
+        }
+    } else if (i >= upper_) {
+        upper_ = i + 1;
+    }
+
+    frac_[i] += pos;
+    ++count_[i];
+}
+
+Result Filter::filter() const {
+    u32x16 count = {}, frac = {};
+    i32x16 index = {};
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        count[i] = count_[i];
+        frac[i] = frac_[i];
+        index[i] = i < upper_ ? i : i - BUCKET_COUNT;
+    }
+
+    uint8_t total = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        total += count[i];
+    }
+    uint8_t thresh = total / BUCKET_COUNT;
+
+    // Buckets reaching the threshold as bit mask.
+    i32x16 full = count >= thresh;
+    uint32_t mask = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        mask |= uint32_t(full[i] & 1) << i;
+    }
+
+    // First full bucket from lower up, else from 0 up.
+    uint32_t above = mask & (~0U << lower_);
+    int start = __builtin_ctz(above != 0 ? above : mask);
+    // Last full bucket from upper down, else from top down.
+    uint32_t below = mask & ((1U << upper_) - 1);
+    int end = 32 - __builtin_clz(below != 0 ? below : mask);
+
+    Result res = {0, 0, total, uint8_t(end - start - 1)};
+
+    i32x16 pos = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    i32x16 sel;
+    if (end <= start) {
+        sel = (pos >= start) | (pos < end);
+        res.span += BUCKET_COUNT;
+    } else {
+        sel = (pos >= start) & (pos < end);
+    }
+
+    uint8_t shift = shift_;
+    constexpr int max_shift = (1 << (8 - SPAN_BITS)) - 1;
+    res.span |= std::min<int>(shift, max_shift) << SPAN_BITS;
+
+    u32x16 c = count & u32x16(sel);
+    i32x16 ci = i32x16(c) * index;
+    u32x16 f = frac & u32x16(sel);
+    uint32_t csum = 0;
+    int32_t isum = 0;
+    uint32_t fsum = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        csum += c[i];
+        isum += ci[i];
+        fsum += f[i];
+    }
+    res.count = csum;
+    // Firmware sums indices in 16 bits.
+    int16_t index_sum = int16_t(isum);
+
+    if (shift <= FRAC_BITS) {
+        fsum >>= FRAC_BITS - shift;
+    } else {
+        fsum = (fsum << (shift - FRAC_BITS)) +
+               (uint32_t(res.count) << (shift - FRAC_BITS - 1));
+    }
+    res.sum = base_ * res.count + (uint32_t(int32_t(index_sum)) << shift) +
+              fsum;
+    return res;
+}
+
+Result filter_session(const Session &s, uint8_t min_shift, Result *series) {
+    Filter f(min_shift);
+    Result r = f.filter();
+    for (size_t i = 0; i < s.count; ++i) {
+        f.add(s.samples[i]);
+        if (series != nullptr || i + 1 == s.count) {
+            r = f.filter();
+        }
+        if (series != nullptr) {
+            series[i] = r;
+        }
+    }
+    return r;
+}
+
+void filter_sessions(const Session *sessions, size_t n, Result *out,
+                     uint8_t min_shift, unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    threads = std::min<size_t>(threads, (n + CHUNK - 1) / CHUNK);
+
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (;;) {
+            size_t b = next.fetch_add(CHUNK);
+            if (b >= n)
+                break;
+            size_t e = std::min(n, b + CHUNK);
+            for (size_t i = b; i < e; ++i) {
+                out[i] = filter_session(sessions[i], min_shift);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (std::thread &t : pool) {
+        t.join();
+    }
+}
+
+} // namespace bucketfilter
@@ -0,0 +1,82 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+// Host implementation of the bucket filter of buckets.c for reprocessing
+// recorded sessions. Results are bit-exact to the firmware, including the
+// wrap-around of its 8 and 16 bit counters.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bucketfilter {
+
+/// Number of buckets, equal to BUCKET_COUNT of buckets.c.
+constexpr int BUCKET_COUNT = 12;
+
+/// Result of filter, equal to accu_t of buckets.h.
+struct Result {
+    uint32_t sum;
+    uint8_t count;
+    uint8_t total;
+    uint8_t span;
+
+    bool operator==(const Result &o) const {
+        return sum == o.sum && count == o.count && total == o.total &&
+               span == o.span;
+    }
+    bool operator!=(const Result &o) const {
+        return !(*this == o);
+    }
+};
+
+class Filter {
+  public:
+    explicit Filter(uint8_t min_shift = 1) : min_shift_(min_shift) {}
+
+    void reset();
+    void add(uint32_t val);
+    Result filter() const;
+
+  private:
+    void deflate();
+    void merge(int dst, int src0);
+    void move(int dst, int src, bool upper);
+
+    alignas(64) uint16_t frac_[BUCKET_COUNT] = {};
+    alignas(16) uint8_t count_[BUCKET_COUNT] = {};
+    uint32_t base_ = 0;
+    uint8_t shift_ = 0;
+    int8_t lower_ = 0;
+    int8_t upper_ = 0;
+    uint8_t min_shift_;
+};
+
+/// Raw weights of one measurement.
+struct Session {
+    const uint32_t *samples;
+    size_t count;
+};
+
+/**
+ * @brief Filter session like TWI_CMD_MEASURE_WEIGHT.
+ *
+ * @param series Result after each sample, count entries, or nullptr
+ * @return Result after last sample.
+ */
+Result filter_session(const Session &s, uint8_t min_shift,
+                      Result *series = nullptr);
+
+/**
+ * @brief Filter many sessions in parallel.
+ *
+ * @param out Result after last sample of each session
+ * @param threads Number of worker threads, 0 selects hardware concurrency
+ */
+void filter_sessions(const Session *sessions, size_t n, Result *out,
+                     uint8_t min_shift, unsigned threads = 0);
+
+} // namespace bucketfilter
@@ -0,0 +1,294 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+// Generator of per-device EEPROM images for provisioning.
+//
+// Reads a CSV with one device per row and writes one Intel HEX file per
+// device, <serial>.eep, with the same addressing as the %.eep rule of the
+// firmware Makefile. The layout is taken from struct nvm_layout in nvm.h.
+//
+// The first row names the columns, unknown columns are ignored:
+//   serial       file name of the image, required
+//   addr         TWI address
+//   offset       HX711 offset
+//   scale        HX711 scale in 1/256
+//   pull_in_ms   valve pull-in time
+//   hold_duty    valve hold duty cycle in 1/256
+//   max_weight   interlock weight limit
+//   max_rate     interlock rate limit in weight units per second
+//   max_runtime  interlock runtime limit in seconds
+//   tare0..tare7 container tare weights
+// Missing columns and empty fields stay erased, which selects the firmware
+// defaults. Numbers may be decimal or hex with 0x prefix. Offset and scale
+// must be given together.
+//
+// Firmware before struct nvm_layout kept its settings in separate EEMEM
+// variables, placed by the linker in an unspecified order. Devices running
+// such firmware must be provisioned anew after the update.
+
+#include "../nvm.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <strings.h>
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+struct Field {
+    const char *name;
+    size_t offset;
+    size_t size;
+    uint32_t min;
+    uint32_t max;
+};
+
+const Field fields[] = {
+    {"addr", offsetof(nvm_layout, twi_addr), 1, 0x08, 0x77},
+    {"offset", offsetof(nvm_layout, calib.hx711.offset), 4, 0, 0xFFFFFFFF},
+    {"scale", offsetof(nvm_layout, calib.hx711.scale), 2, 1, 0xFFFF},
+    {"pull_in_ms", offsetof(nvm_layout, valve.pull_in_ms), 2, 0, 0xFFFF},
+    {"hold_duty", offsetof(nvm_layout, valve.hold_duty), 1, 0, 0xFF},
+    {"max_weight", offsetof(nvm_layout, limits.max_weight), 4, 0, 0xFFFFFFFF},
+    {"max_rate", offsetof(nvm_layout, limits.max_rate), 2, 0, 0xFFFF},
+    {"max_runtime", offsetof(nvm_layout, limits.max_runtime), 2, 0, 0xFFFF},
+    {"tare0", offsetof(nvm_layout, tares.tare[0]), 4, 0, 0xFFFFFFFE},
+    {"tare1", offsetof(nvm_layout, tares.tare[1]), 4, 0, 0xFFFFFFFE},
+    {"tare2", offsetof(nvm_layout, tares.tare[2]), 4, 0, 0xFFFFFFFE},
+    {"tare3", offsetof(nvm_layout, tares.tare[3]), 4, 0, 0xFFFFFFFE},
+    {"tare4", offsetof(nvm_layout, tares.tare[4]), 4, 0, 0xFFFFFFFE},
+    {"tare5", offsetof(nvm_layout, tares.tare[5]), 4, 0, 0xFFFFFFFE},
+    {"tare6", offsetof(nvm_layout, tares.tare[6]), 4, 0, 0xFFFFFFFE},
+    {"tare7", offsetof(nvm_layout, tares.tare[7]), 4, 0, 0xFFFFFFFE},
+};
+
+static_assert(NVM_TARE_COUNT == 8, "Update tare columns");
+
+struct Device {
+    std::string serial;
+    Bytes image;
+};
+
+std::vector<std::string> split(const std::string &line) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string f;
+    while (std::getline(ss, f, ',')) {
+        size_t b = f.find_first_not_of(" \t\r\"");
+        size_t e = f.find_last_not_of(" \t\r\"");
+        fields.push_back(b == std::string::npos ? "" : f.substr(b, e - b + 1));
+    }
+    return fields;
+}
+
+bool parse_number(const std::string &s, uint32_t &val) {
+    if (s.empty() || s[0] == '-')
+        return false;
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long v = strtoull(s.c_str(), &end, 0);
+    if (errno != 0 || *end != '\0' || v > 0xFFFFFFFFULL)
+        return false;
+    val = uint32_t(v);
+    return true;
+}
+
+bool valid_serial(const std::string &s) {
+    if (s.empty() || s[0] == '.')
+        return false;
+    for (char c : s) {
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.')
+            return false;
+    }
+    return true;
+}
+
+/// Store little endian like the AVR.
+void store(Bytes &image, size_t offset, size_t size, uint32_t val) {
+    for (size_t i = 0; i < size; ++i) {
+        image[offset + i] = (val >> (8 * i)) & 0xff;
+    }
+}
+
+bool erased(const Bytes &image, size_t offset, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (image[offset + i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+bool parse(std::istream &in, std::vector<Device> &devices) {
+    std::vector<int> columns;
+    int serial = -1;
+    std::set<std::string> serials;
+    std::string line;
+    int n = 0;
+    bool ok = true;
+
+    while (std::getline(in, line)) {
+        ++n;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> f = split(line);
+        if (serial < 0) {
+            // Header row
+            columns.assign(std::size(fields), -1);
+            for (size_t i = 0; i < f.size(); ++i) {
+                if (strcasecmp(f[i].c_str(), "serial") == 0)
+                    serial = int(i);
+                for (size_t k = 0; k < std::size(fields); ++k) {
+                    if (strcasecmp(f[i].c_str(), fields[k].name) == 0)
+                        columns[k] = int(i);
+                }
+            }
+            if (serial < 0) {
+                fprintf(stderr, "line %d: header has no serial column\n", n);
+                return false;
+            }
+            continue;
+        }
+
+        Device d{int(f.size()) > serial ? f[serial] : "",
+                 Bytes(sizeof(nvm_layout), 0xFF)};
+        if (!valid_serial(d.serial)) {
+            fprintf(stderr, "line %d: invalid serial '%s'\n", n,
+                    d.serial.c_str());
+            ok = false;
+            continue;
+        }
+        if (!serials.insert(d.serial).second) {
+            fprintf(stderr, "line %d: duplicate serial %s\n", n,
+                    d.serial.c_str());
+            ok = false;
+            continue;
+        }
+        for (size_t k = 0; k < std::size(fields); ++k) {
+            int c = columns[k];
+            if (c < 0 || c >= int(f.size()) || f[c].empty())
+                continue;
+            uint32_t v;
+            if (!parse_number(f[c], v) || v < fields[k].min ||
+                v > fields[k].max) {
+                fprintf(stderr, "line %d: invalid %s '%s'\n", n,
+                        fields[k].name, f[c].c_str());
+                ok = false;
+                continue;
+            }
+            store(d.image, fields[k].offset, fields[k].size, v);
+        }
+        // Firmware replaces offset and scale only if both are erased. An
+        // erased offset alone makes every weight zero.
+        if (erased(d.image, offsetof(nvm_layout, calib.hx711.scale), 2) !=
+            erased(d.image, offsetof(nvm_layout, calib.hx711.offset), 4)) {
+            fprintf(stderr, "line %d: offset requires scale and vice versa\n",
+                    n);
+            ok = false;
+        }
+        devices.push_back(d);
+    }
+    return ok;
+}
+
+void write_record(std::ostream &out, uint8_t type, uint16_t addr,
+                  const uint8_t *data, size_t len) {
+    uint8_t sum = len + (addr >> 8) + (addr & 0xff) + type;
+    char buf[16];
+    snprintf(buf, sizeof buf, ":%02X%04X%02X", unsigned(len), addr, type);
+    out << buf;
+    for (size_t i = 0; i < len; ++i) {
+        snprintf(buf, sizeof buf, "%02X", data[i]);
+        out << buf;
+        sum += data[i];
+    }
+    snprintf(buf, sizeof buf, "%02X\n", uint8_t(-sum));
+    out << buf;
+}
+
+void write_hex(std::ostream &out, const Bytes &image) {
+    for (size_t a = 0; a < image.size(); a += 16) {
+        size_t len = std::min<size_t>(16, image.size() - a);
+        write_record(out, 0x00, uint16_t(a), &image[a], len);
+    }
+    write_record(out, 0x01, 0, nullptr, 0);
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options] [devices.csv]\n"
+            "  -o DIR        output directory (default: .)\n"
+            "  -n            only check the CSV\n",
+            prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string dir = ".";
+    const char *path = nullptr;
+    bool dry_run = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if (a == "-o" && has_arg) {
+            dir = argv[++i];
+        } else if (a == "-n") {
+            dry_run = true;
+        } else if (a[0] == '-' && a != "-") {
+            usage(argv[0]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    std::vector<Device> devices;
+    bool ok;
+    if (!path || strcmp(path, "-") == 0) {
+        ok = parse(std::cin, devices);
+    } else {
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return 1;
+        }
+        ok = parse(in, devices);
+    }
+    // Write nothing unless all rows are valid.
+    if (!ok)
+        return 1;
+
+    for (const Device &d : devices) {
+        std::string name = dir + "/" + d.serial + ".eep";
+        if (dry_run) {
+            printf("%s\n", name.c_str());
+            continue;
+        }
+        std::ofstream out(name);
+        write_hex(out, d.image);
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", name.c_str());
+            return 1;
+        }
+    }
+    fprintf(stderr, "%zu images of %zu bytes\n", devices.size(),
+            sizeof(nvm_layout));
+    return 0;
+}
@@ -0,0 +1,9 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+// Host replacement of avr-libc headers to compile hardware independent
+// firmware modules like buckets.c for the host tools.
+
+#pragma once
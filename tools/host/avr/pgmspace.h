@@ -0,0 +1,11 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <string.h>
+
+#define strlen_P  strlen
+#define strncmp_P strncmp
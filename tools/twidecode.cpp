@@ -0,0 +1,805 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+// Decoder for logic analyzer captures of the scale's TWI protocol.
+//
+// Reads a CSV export of SCL and SDA (sigrok-cli -O csv, or any CSV with an
+// optional time column), reconstructs I2C transactions, decodes commands and
+// responses as defined in twi.h, checks the CRC-5 of responses and reports
+// timing, clock stretching and the likely cause of NACKs.
+
+#define __flash
+#include "../nvm.h"
+#include "../stepper.h"
+#include "../twi.h"
+#undef __flash
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <strings.h>
+
+namespace {
+
+/// 4-bit lookup table for CRC-5-ITU with polynom 0x15, ref-in, ref-out
+const uint8_t crc_table[16] = {0x00, 0x0d, 0x1a, 0x17, 0x1f, 0x12,
+                               0x05, 0x08, 0x15, 0x18, 0x0f, 0x02,
+                               0x0a, 0x07, 0x10, 0x1d};
+
+uint8_t crc5(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t val = data[i];
+        crc = crc_table[(crc ^ val) & 0x0f] ^ (crc >> 4);
+        crc = crc_table[(crc ^ (val >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return crc & 0x1f;
+}
+
+uint16_t be16(const uint8_t *d) {
+    return (uint16_t(d[0]) << 8) | d[1];
+}
+
+uint32_t be32(const uint8_t *d) {
+    return (uint32_t(be16(d)) << 16) | be16(d + 2);
+}
+
+using Bytes = std::vector<uint8_t>;
+using Format = std::string (*)(const Bytes &);
+
+struct Command {
+    uint8_t code;
+    const char *name;
+    /// Number of payload bytes following the command byte.
+    int payload;
+    /// Number of response bytes without CRC, or -1 if there is no response.
+    int response;
+    Format decode_payload;
+    Format decode_response;
+};
+
+std::string fmt(const char *f, ...) __attribute__((format(printf, 1, 2)));
+
+std::string fmt(const char *f, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, f);
+    vsnprintf(buf, sizeof buf, f, ap);
+    va_end(ap);
+    return buf;
+}
+
+std::string dec_measure(const Bytes &d) {
+    uint32_t sum = be32(&d[1]);
+    double mean = d[0] ? double(sum) / d[0] : 0.0;
+    return fmt("count=%u sum=%u mean=%.2f total=%u span=%u shift=%u", d[0],
+               sum, mean, d[5], d[6] & 0xf, d[6] >> 4);
+}
+
+std::string dec_track(const Bytes &d) {
+    return fmt("weight=%u age=%ums", be32(&d[0]), d[4]);
+}
+
+std::string dec_temp(const Bytes &d) {
+    return fmt("temp=%.2fC", int16_t(be16(&d[0])) / 16.0);
+}
+
+std::string dec_calib(const Bytes &d) {
+    return fmt("offset=%u scale=%u/256", be32(&d[0]), be16(&d[4]));
+}
+
+std::string dec_rotate(const Bytes &d) {
+    return fmt("dir=%c cycles=%u maxspd=%u", (d[0] & 0x80) ? '+' : '-',
+               (d[0] & 0x7f) + 1, d[1]);
+}
+
+std::string dec_cycle(const Bytes &d) {
+    return fmt("cycle=%u", d[0]);
+}
+
+std::string dec_byte(const Bytes &d) {
+    return fmt("value=0x%02x", d[0]);
+}
+
+std::string dec_log_cfg(const Bytes &d) {
+    return fmt("mask=0x%02x level=%u", d[0], d[1]);
+}
+
+std::string dec_read_mode(const Bytes &d) {
+    static const char *modes[] = {"repeat", "fresh-nack", "fresh-stretch"};
+    return fmt("mode=%s timeout=%ums", d[0] < 3 ? modes[d[0]] : "invalid",
+               d[1]);
+}
+
+std::string dec_page(const Bytes &d) {
+    std::string s = fmt("offset=%u data=", d[0]);
+    for (size_t i = 1; i <= TWI_BLOB_PAGE; ++i)
+        s += fmt("%02x", d[i]);
+    uint8_t crc = crc5(d.data(), TWI_BLOB_PAGE + 1);
+    return s + fmt(" crc %s", (d[TWI_BLOB_PAGE + 1] & 0x1f) == crc
+                                  ? "ok"
+                                  : "MISMATCH");
+}
+
+std::string dec_page_result(const Bytes &d) {
+    static const char *results[] = {"ok", "crc error", "out of order",
+                                    "overflow", "busy"};
+    return fmt("result=%s received=%u", d[0] < 5 ? results[d[0]] : "invalid",
+               d[1]);
+}
+
+std::string dec_region(const Bytes &d) {
+    return fmt("region=%u", d[0]);
+}
+
+std::string dec_region_write(const Bytes &d) {
+    return fmt("region=%u confirm=0x%02x", d[0], d[1]);
+}
+
+std::string dec_move_to(const Bytes &d) {
+    return fmt("pos=%d maxspd=%u", int32_t(be32(&d[0])), d[4]);
+}
+
+std::string dec_pos(const Bytes &d) {
+    return fmt("pos=%d", int32_t(be32(&d[0])));
+}
+
+std::string dec_modulus(const Bytes &d) {
+    return fmt("modulus=%u", be32(&d[0]));
+}
+
+std::string dec_position(const Bytes &d) {
+    return fmt("pos=%d running=%u", int32_t(be32(&d[0])), d[4]);
+}
+
+std::string dec_home(const Bytes &d) {
+    return fmt("dir=%c fast=%u slow=%u backoff=%u travel=%u",
+               (d[0] & 0x80) ? '+' : '-', d[1], d[2], be16(&d[3]),
+               be16(&d[5]));
+}
+
+std::string dec_feed(const Bytes &d) {
+    return fmt("dir=%c rate=%u/min sps=%u refill=%u",
+               (d[0] & 0x80) ? '+' : '-', be16(&d[1]), be16(&d[3]),
+               be16(&d[5]));
+}
+
+std::string dec_feed_state(const Bytes &d) {
+    return fmt("weight=%u rate=%d/min%s%s", be32(&d[0]),
+               int16_t(be16(&d[4])), (d[6] & 0x01) ? " refill" : "",
+               (d[6] & 0x02) ? " settling" : "");
+}
+
+std::string dec_arm_trigger(const Bytes &d) {
+    return fmt("task=0x%02x edge=%s", d[0],
+               (d[1] & TWI_TRIGGER_RISING) ? "rising" : "falling");
+}
+
+std::string dec_trigger(const Bytes &d) {
+    return fmt("fired=%u time=%.1fms", d[0], be16(&d[1]) * 1000.0 / 1024);
+}
+
+std::string dec_latency(const Bytes &d) {
+    return fmt("wake=%uus awake=%uus", be16(&d[0]), be16(&d[2]));
+}
+
+std::string dec_count(const Bytes &d) {
+    return fmt("count=%u", d[0]);
+}
+
+std::string dec_noise(const Bytes &d) {
+    return fmt("mean=%u std=%.2f pp=%u enob=%.3f",
+               (d[0] << 16) | (d[1] << 8) | d[2], be16(&d[3]) / 16.0,
+               be16(&d[5]), d[7] / 8.0);
+}
+
+std::string dec_benchmark(const Bytes &d) {
+    return fmt("kernel=%u count=%u", d[0], d[1] ? d[1] : 256);
+}
+
+std::string dec_bench_result(const Bytes &d) {
+    return fmt("min=%u avg=%u max=%u cycles", be16(&d[0]), be16(&d[2]),
+               be16(&d[4]));
+}
+
+std::string dec_tare_index(const Bytes &d) {
+    return d[0] == NVM_TARE_NONE ? "tare=none" : fmt("tare=%u", d[0]);
+}
+
+std::string dec_tare(const Bytes &d) {
+    return dec_tare_index(d) + fmt(" weight=%u", be32(&d[1]));
+}
+
+std::string dec_ms(const Bytes &d) {
+    return fmt("time=%ums", be16(&d[0]));
+}
+
+std::string dec_stepper_stats(const Bytes &d) {
+    return fmt("latency=%uus awake=%u max_delay=%u late=%u", be16(&d[0]),
+               d[2], be16(&d[3]), be16(&d[5]));
+}
+
+std::string dec_stepper_delays(const Bytes &d) {
+    std::string s;
+    for (int i = 0; i < STEPPER_DELAY_BINS; ++i) {
+        s += fmt("%s%s%u=%u", i ? " " : "",
+                 i + 1 < STEPPER_DELAY_BINS ? "<" : ">=",
+                 (i + (i + 1 < STEPPER_DELAY_BINS)) << STEPPER_DELAY_SHIFT,
+                 be16(&d[2 * i]));
+    }
+    return s;
+}
+
+std::string dec_version(const Bytes &d) {
+    return fmt("version=%u.%u.%u%s hash=%04x api=%u", d[0], d[1],
+               d[2] & 0x7f, (d[2] & 0x80) ? "-dirty" : "", d[3] | (d[4] << 8),
+               d[5]);
+}
+
+std::string dec_status(const Bytes &d) {
+    std::string flags;
+    if (d[0] & TWI_STATUS_VALVE_OPEN)
+        flags += " valve";
+    if (d[0] & TWI_STATUS_STEPPER_RUNNING)
+        flags += " stepper";
+    if (d[0] & TWI_STATUS_HX711_ACTIVE)
+        flags += " hx711";
+    if (d[0] & TWI_STATUS_WD_ENABLED)
+        flags += " wd";
+    if (d[0] & TWI_STATUS_HOMING)
+        flags += " homing";
+    if (d[0] & TWI_STATUS_HOMED)
+        flags += " homed";
+    if (d[0] & TWI_STATUS_HOME_FAILED)
+        flags += " home-failed";
+    if (d[0] & TWI_STATUS_TRIPPED)
+        flags += " tripped";
+    static const char *trips[] = {"none", "weight", "rate", "runtime"};
+    return fmt("flags=[%s ] task=0x%02x samples=%u commands=%u cycle=%u "
+               "trip=%s",
+               flags.c_str(), d[1], be16(&d[2]), be16(&d[4]), d[6],
+               d[7] < 4 ? trips[d[7]] : "invalid");
+}
+
+std::string dec_log(const Bytes &d) {
+    std::string s = fmt("lost=%u text=\"", d[0]);
+    for (size_t i = 0; i < d[1] && i + 2 < d.size(); ++i) {
+        char c = char(d[i + 2]);
+        if (c == '\n')
+            s += "\\n";
+        else if (c >= ' ' && c < 0x7f)
+            s += c;
+        else
+            s += fmt("\\x%02x", uint8_t(c));
+    }
+    return s + "\"";
+}
+
+const Command commands[] = {
+    {TWI_CMD_SLEEP, "SLEEP", 0, -1, nullptr, nullptr},
+    {TWI_CMD_MEASURE_WEIGHT, "MEASURE_WEIGHT", 0, 7, nullptr, dec_measure},
+    {TWI_CMD_TRACK_WEIGHT, "TRACK_WEIGHT", 0, 5, nullptr, dec_track},
+    {TWI_CMD_OPEN_VALVE, "OPEN_VALVE", 0, -1, nullptr, nullptr},
+    {TWI_CMD_CLOSE_VALVE, "CLOSE_VALVE", 0, -1, nullptr, nullptr},
+    {TWI_CMD_GET_TEMP, "GET_TEMP", 0, 2, nullptr, dec_temp},
+    {TWI_CMD_GET_CALIB, "GET_CALIB", 0, 6, nullptr, dec_calib},
+    {TWI_CMD_SET_CALIB, "SET_CALIB", 6, -1, dec_calib, nullptr},
+    {TWI_CMD_ENABLE_WD, "ENABLE_WD", 0, -1, nullptr, nullptr},
+    {TWI_CMD_ROTATE, "ROTATE", 2, 1, dec_rotate, dec_cycle},
+    {TWI_CMD_SET_LOG, "SET_LOG", 2, -1, dec_log_cfg, nullptr},
+    {TWI_CMD_SET_READ_MODE, "SET_READ_MODE", 2, -1, dec_read_mode, nullptr},
+    {TWI_CMD_BLOB_PAGE, "BLOB_PAGE", TWI_BUFFER_SIZE, 2, dec_page,
+     dec_page_result},
+    {TWI_CMD_BLOB_COMMIT, "BLOB_COMMIT", 1, -1, dec_region, nullptr},
+    {TWI_CMD_MOVE_TO, "MOVE_TO", 5, -1, dec_move_to, nullptr},
+    {TWI_CMD_SET_POSITION, "SET_POSITION", 4, -1, dec_pos, nullptr},
+    {TWI_CMD_SET_MODULUS, "SET_MODULUS", 4, -1, dec_modulus, nullptr},
+    {TWI_CMD_HOME, "HOME", 7, -1, dec_home, nullptr},
+    {TWI_CMD_FEED, "FEED", 7, 7, dec_feed, dec_feed_state},
+    {TWI_CMD_CLEAR_TRIP, "CLEAR_TRIP", 0, -1, nullptr, nullptr},
+    {TWI_CMD_ARM_TRIGGER, "ARM_TRIGGER", 2, -1, dec_arm_trigger, nullptr},
+    {TWI_CMD_NOISE_TEST, "NOISE_TEST", 1, 8, dec_count, dec_noise},
+    {TWI_CMD_BENCHMARK, "BENCHMARK", 2, 6, dec_benchmark, dec_bench_result},
+    {TWI_CMD_SELECT_TARE, "SELECT_TARE", 1, -1, dec_tare_index, nullptr},
+    {TWI_CMD_SET_KEEP_AWAKE, "SET_KEEP_AWAKE", 2, -1, dec_ms, nullptr},
+    {TWI_CMD_CALIB_WRITE, "CALIB_WRITE", 1, -1, dec_byte, nullptr},
+    {TWI_CMD_SET_ADDR, "SET_ADDR", 1, -1, dec_byte, nullptr},
+    {TWI_CMD_ADDR_WRITE, "ADDR_WRITE", 1, -1, dec_byte, nullptr},
+    {TWI_CMD_DISABLE_WD, "DISABLE_WD", 1, -1, dec_byte, nullptr},
+    {TWI_CMD_BLOB_WRITE, "BLOB_WRITE", 2, -1, dec_region_write, nullptr},
+    {TWI_CMD_GET_VERSION, "GET_VERSION", 0, 6, nullptr, dec_version},
+    {TWI_CMD_GET_LOG, "GET_LOG", 0, TWI_BUFFER_SIZE, nullptr, dec_log},
+    {TWI_CMD_GET_STATUS, "GET_STATUS", 0, 8, nullptr, dec_status},
+    {TWI_CMD_GET_POSITION, "GET_POSITION", 0, 5, nullptr, dec_position},
+    {TWI_CMD_GET_STEPPER_STATS, "GET_STEPPER_STATS", 0, 7, nullptr,
+     dec_stepper_stats},
+    {TWI_CMD_GET_STEPPER_DELAYS, "GET_STEPPER_DELAYS", 0,
+     2 * STEPPER_DELAY_BINS, nullptr, dec_stepper_delays},
+    {TWI_CMD_GET_TRIGGER, "GET_TRIGGER", 0, 3, nullptr, dec_trigger},
+    {TWI_CMD_GET_LATENCY, "GET_LATENCY", 0, 4, nullptr, dec_latency},
+    {TWI_CMD_GET_TARE, "GET_TARE", 0, 5, nullptr, dec_tare},
+};
+
+const Command *find_command(uint8_t code) {
+    for (const Command &c : commands) {
+        if (c.code == code)
+            return &c;
+    }
+    return nullptr;
+}
+
+struct Byte {
+    uint8_t value = 0;
+    bool ack = false;
+    double t = 0;
+    /// Longest SCL low phase preceding a bit of this byte.
+    double max_low = 0;
+};
+
+struct Frame {
+    double t = 0;
+    std::vector<Byte> bytes; // first byte is address
+};
+
+struct Transaction {
+    double start = 0;
+    double end = 0;
+    std::vector<Frame> frames;
+    std::vector<double> lows;
+    bool stopped = false;
+};
+
+struct Stats {
+    unsigned transactions = 0;
+    unsigned crc_errors = 0;
+    std::map<std::string, unsigned> nacks;
+    double max_stretch = 0;
+    double max_duration = 0;
+    double sum_duration = 0;
+};
+
+struct Options {
+    std::string scl = "";
+    std::string sda = "";
+    double rate = 0;
+    int addr = -1;
+    bool verbose = false;
+};
+
+class I2cDecoder {
+  public:
+    I2cDecoder(const Options &opt) : opt_(opt) {}
+
+    void sample(double t, bool scl, bool sda) {
+        if (first_) {
+            first_ = false;
+            scl_ = scl;
+            sda_ = sda;
+            return;
+        }
+        if (scl && scl_ && sda != sda_) {
+            if (!sda) {
+                start(t);
+            } else {
+                stop(t);
+            }
+        } else if (scl && !scl_) {
+            rising(t, sda);
+        } else if (!scl && scl_) {
+            low_start_ = t;
+        }
+        scl_ = scl;
+        sda_ = sda;
+    }
+
+    void finish() {
+        if (active_) {
+            trans_.end = low_start_;
+            report();
+        }
+        summary();
+    }
+
+  private:
+    /// Drop bits clocked in by the SCL rising edge of a start or stop.
+    void drop_partial_byte() {
+        if (active_ && bit_ > 0 && !trans_.frames.back().bytes.empty()) {
+            trans_.frames.back().bytes.pop_back();
+        }
+        bit_ = 0;
+    }
+
+    void start(double t) {
+        drop_partial_byte();
+        if (!active_) {
+            trans_ = Transaction();
+            trans_.start = t;
+            active_ = true;
+        }
+        trans_.frames.emplace_back();
+        trans_.frames.back().t = t;
+        low_start_ = -1;
+        max_low_ = 0;
+    }
+
+    void stop(double t) {
+        if (!active_)
+            return;
+        drop_partial_byte();
+        trans_.end = t;
+        trans_.stopped = true;
+        report();
+        active_ = false;
+    }
+
+    void rising(double t, bool sda) {
+        if (!active_)
+            return;
+        if (low_start_ >= 0) {
+            double low = t - low_start_;
+            trans_.lows.push_back(low);
+            max_low_ = std::max(max_low_, low);
+        }
+        Frame &f = trans_.frames.back();
+        if (bit_ == 0) {
+            f.bytes.emplace_back();
+            f.bytes.back().t = t;
+        }
+        Byte &b = f.bytes.back();
+        if (bit_ < 8) {
+            b.value = (b.value << 1) | (sda ? 1 : 0);
+            ++bit_;
+        } else {
+            b.ack = !sda;
+            b.max_low = max_low_;
+            max_low_ = 0;
+            bit_ = 0;
+        }
+    }
+
+    static double median(std::vector<double> v) {
+        if (v.empty())
+            return 0;
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2];
+    }
+
+    void nack(const std::string &cause) {
+        ++stats_.nacks[cause];
+        printf("  NACK: %s\n", cause.c_str());
+    }
+
+    void report_write(const Frame &f, uint8_t addr) {
+        const std::vector<Byte> &b = f.bytes;
+        if (b.size() < 2) {
+            return;
+        }
+        uint8_t code = b[1].value;
+        const Command *cmd = find_command(code);
+        last_cmd_[addr] = code;
+        Bytes payload;
+        for (size_t i = 2; i < b.size(); ++i)
+            payload.push_back(b[i].value);
+
+        printf("  W 0x%02x %s (0x%02x)", addr, cmd ? cmd->name : "UNKNOWN",
+               code);
+        if (cmd && cmd->decode_payload &&
+            payload.size() == size_t(cmd->payload)) {
+            printf(" %s", cmd->decode_payload(payload).c_str());
+        } else if (!payload.empty()) {
+            for (uint8_t v : payload)
+                printf(" %02x", v);
+        }
+        printf("\n");
+
+        if (!cmd) {
+            return;
+        }
+        // Device ACKs all bytes of the payload except the last one.
+        size_t expected = 2 + cmd->payload;
+        for (size_t i = 1; i < b.size(); ++i) {
+            if (!b[i].ack && i + 1 < expected) {
+                nack(fmt("byte %zu of %s rejected", i - 1, cmd->name));
+            }
+        }
+        if (b.size() < expected) {
+            printf("  payload truncated: %zu of %d bytes\n", b.size() - 2,
+                   cmd->payload);
+        } else if (b.size() > expected) {
+            nack(fmt("%s: %zu excess bytes", cmd->name, b.size() - expected));
+        }
+    }
+
+    void report_read(const Frame &f, uint8_t addr) {
+        const std::vector<Byte> &b = f.bytes;
+        Bytes data;
+        for (size_t i = 1; i < b.size(); ++i)
+            data.push_back(b[i].value);
+
+        auto it = last_cmd_.find(addr);
+        const Command *cmd =
+            it != last_cmd_.end() ? find_command(it->second) : nullptr;
+        printf("  R 0x%02x", addr);
+        for (uint8_t v : data)
+            printf(" %02x", v);
+        printf("\n");
+        if (data.empty()) {
+            return;
+        }
+
+        size_t n = data.size() - 1;
+        if (cmd && cmd->response >= 0 && data.size() > size_t(cmd->response)) {
+            n = cmd->response;
+        }
+        uint8_t crc = crc5(data.data(), n);
+        bool ok = (data[n] & 0x1f) == crc;
+        if (!ok)
+            ++stats_.crc_errors;
+        printf("    crc 0x%02x %s", data[n], ok ? "ok" : "MISMATCH");
+        if (!ok)
+            printf(" (expected 0x%02x)", crc);
+        if (cmd && cmd->decode_response && cmd->response >= 0 &&
+            n == size_t(cmd->response)) {
+            Bytes resp(data.begin(), data.begin() + n);
+            printf("  %s: %s", cmd->name, cmd->decode_response(resp).c_str());
+        }
+        printf("\n");
+        for (size_t i = 1; i + 1 < b.size(); ++i) {
+            if (!b[i].ack) {
+                printf("  master NACKed byte %zu before end of read\n", i - 1);
+            }
+        }
+    }
+
+    void report() {
+        if (trans_.frames.empty() || trans_.frames[0].bytes.empty())
+            return;
+        uint8_t addr = trans_.frames[0].bytes[0].value >> 1;
+        if (opt_.addr >= 0 && opt_.addr != addr)
+            return;
+
+        double dur = trans_.end - trans_.start;
+        double nominal = median(trans_.lows);
+        ++stats_.transactions;
+        stats_.sum_duration += dur;
+        stats_.max_duration = std::max(stats_.max_duration, dur);
+
+        printf("#%u %.6fs dur %.1fus", stats_.transactions, trans_.start,
+               dur * 1e6);
+        if (nominal > 0) {
+            printf(" scl low %.1fus", nominal * 1e6);
+        }
+        if (!trans_.stopped) {
+            printf(" (no stop)");
+        }
+        printf("\n");
+
+        for (size_t fi = 0; fi < trans_.frames.size(); ++fi) {
+            const Frame &f = trans_.frames[fi];
+            if (f.bytes.empty()) {
+                continue;
+            }
+            if (fi > 0) {
+                printf("  Sr +%.1fus\n", (f.t - trans_.start) * 1e6);
+            }
+            const Byte &a = f.bytes[0];
+            bool read = (a.value & 1) != 0;
+            uint8_t faddr = a.value >> 1;
+            if (!a.ack) {
+                if (read) {
+                    nack(fmt("read 0x%02x: no fresh response loaded "
+                             "or stretch timeout",
+                             faddr));
+                } else {
+                    nack(fmt("write 0x%02x: previous command still pending "
+                             "or device absent",
+                             faddr));
+                }
+                continue;
+            }
+            if (read) {
+                report_read(f, faddr);
+            } else {
+                report_write(f, faddr);
+            }
+
+            for (size_t i = 0; i < f.bytes.size(); ++i) {
+                double stretch = f.bytes[i].max_low - nominal;
+                if (nominal > 0 && stretch > nominal) {
+                    stats_.max_stretch = std::max(stats_.max_stretch, stretch);
+                    printf("  stretch %.1fus %s\n", stretch * 1e6,
+                           i == 0 ? "at address" : fmt("at byte %zu", i).c_str());
+                }
+            }
+            if (opt_.verbose) {
+                for (const Byte &b : f.bytes) {
+                    printf("    %.6fs %02x %s\n", b.t, b.value,
+                           b.ack ? "ACK" : "NACK");
+                }
+            }
+        }
+    }
+
+    void summary() const {
+        printf("\n%u transactions", stats_.transactions);
+        if (stats_.transactions > 0) {
+            printf(", mean %.1fus, max %.1fus",
+                   stats_.sum_duration / stats_.transactions * 1e6,
+                   stats_.max_duration * 1e6);
+        }
+        printf("\ncrc errors: %u\nmax stretch: %.1fus\n", stats_.crc_errors,
+               stats_.max_stretch * 1e6);
+        for (const auto &n : stats_.nacks) {
+            printf("NACK %ux: %s\n", n.second, n.first.c_str());
+        }
+    }
+
+    const Options &opt_;
+    Stats stats_;
+    Transaction trans_;
+    std::map<uint8_t, uint8_t> last_cmd_;
+    bool active_ = false;
+    bool first_ = true;
+    bool scl_ = true;
+    bool sda_ = true;
+    int bit_ = 0;
+    double low_start_ = -1;
+    double max_low_ = 0;
+};
+
+std::vector<std::string> split(const std::string &line) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string f;
+    while (std::getline(ss, f, ',')) {
+        size_t b = f.find_first_not_of(" \t\r\"");
+        size_t e = f.find_last_not_of(" \t\r\"");
+        fields.push_back(b == std::string::npos ? "" : f.substr(b, e - b + 1));
+    }
+    return fields;
+}
+
+bool is_number(const std::string &s) {
+    char *end = nullptr;
+    strtod(s.c_str(), &end);
+    return !s.empty() && end && *end == '\0';
+}
+
+double parse_rate(const std::string &s) {
+    char *end = nullptr;
+    double r = strtod(s.c_str(), &end);
+    while (end && *end == ' ')
+        ++end;
+    if (end && (*end == 'k' || *end == 'K'))
+        r *= 1e3;
+    else if (end && *end == 'M')
+        r *= 1e6;
+    else if (end && *end == 'G')
+        r *= 1e9;
+    return r;
+}
+
+int find_column(const std::vector<std::string> &header, const std::string &sel,
+                const char *name, int fallback) {
+    if (!sel.empty() && is_number(sel))
+        return atoi(sel.c_str());
+    std::string want = sel.empty() ? name : sel;
+    for (size_t i = 0; i < header.size(); ++i) {
+        if (strcasecmp(header[i].c_str(), want.c_str()) == 0)
+            return int(i);
+    }
+    return fallback;
+}
+
+int decode(std::istream &in, const Options &opt) {
+    I2cDecoder dec(opt);
+    double rate = opt.rate;
+    int scl = -1, sda = -1, tcol = -1;
+    bool columns = false;
+    unsigned long index = 0;
+    std::string line;
+
+    while (std::getline(in, line)) {
+        if (line.empty())
+            continue;
+        if (line[0] == ';' || line[0] == '#') {
+            size_t p = line.find("Samplerate:");
+            if (p != std::string::npos && opt.rate == 0)
+                rate = parse_rate(line.substr(p + 11));
+            continue;
+        }
+        std::vector<std::string> f = split(line);
+        if (!columns) {
+            columns = true;
+            if (!is_number(f[0])) {
+                // Header row
+                for (size_t i = 0; i < f.size(); ++i) {
+                    if (strncasecmp(f[i].c_str(), "time", 4) == 0)
+                        tcol = int(i);
+                }
+                int first = tcol == 0 ? 1 : 0;
+                scl = find_column(f, opt.scl, "SCL", first);
+                sda = find_column(f, opt.sda, "SDA", first + 1);
+                continue;
+            }
+            scl = opt.scl.empty() ? 0 : atoi(opt.scl.c_str());
+            sda = opt.sda.empty() ? 1 : atoi(opt.sda.c_str());
+        }
+        if (int(f.size()) <= std::max(scl, sda))
+            continue;
+        double t;
+        if (tcol >= 0) {
+            t = strtod(f[tcol].c_str(), nullptr);
+        } else if (rate > 0) {
+            t = index / rate;
+        } else {
+            fprintf(stderr, "no time column and unknown sample rate, "
+                            "use --rate\n");
+            return 1;
+        }
+        ++index;
+        dec.sample(t, atoi(f[scl].c_str()) != 0, atoi(f[sda].c_str()) != 0);
+    }
+    dec.finish();
+    return 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options] [capture.csv]\n"
+            "  --scl COL     SCL column name or index (default: SCL)\n"
+            "  --sda COL     SDA column name or index (default: SDA)\n"
+            "  --rate HZ     sample rate if capture has no time column\n"
+            "  --addr ADDR   only report transactions with this address\n"
+            "  -v            list every byte with its timestamp\n",
+            prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if (a == "--scl" && has_arg) {
+            opt.scl = argv[++i];
+        } else if (a == "--sda" && has_arg) {
+            opt.sda = argv[++i];
+        } else if (a == "--rate" && has_arg) {
+            opt.rate = parse_rate(argv[++i]);
+        } else if (a == "--addr" && has_arg) {
+            opt.addr = int(strtol(argv[++i], nullptr, 0));
+        } else if (a == "-v") {
+            opt.verbose = true;
+        } else if (a[0] == '-' && a != "-") {
+            usage(argv[0]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (!path || strcmp(path, "-") == 0) {
+        return decode(std::cin, opt);
+    }
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    return decode(in, opt);
+}
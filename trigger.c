@@ -0,0 +1,70 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#include "trigger.h"
+
+#if ENABLE_TRIGGER
+
+#include "config.h"
+#include "hx711.h"
+#include "util.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+static struct {
+    volatile bool fired;
+    volatile bool pending;
+    volatile uint16_t time;
+} trigger;
+
+ISR(TRIG_PORT_VECT) {
+    if ((TRIG_PORT.INTFLAGS & TRIG_BIT) != 0) {
+        // Single shot, disable sensing
+        TRIG_PINCTRL = PORT_ISC_INPUT_DISABLE_gc;
+        TRIG_PORT.INTFLAGS = TRIG_BIT;
+        trigger.time = RTC.CNT;
+        if (hx711_is_off()) {
+            hx711_start_locked();
+        }
+        trigger.fired = true;
+        trigger.pending = true;
+    }
+}
+
+void trigger_arm(bool rising) {
+    LOCKI();
+    trigger.fired = false;
+    trigger.pending = false;
+    TRIG_PORT.DIRCLR = TRIG_BIT;
+    TRIG_PORT.INTFLAGS = TRIG_BIT;
+    TRIG_PINCTRL = rising ? PORT_ISC_RISING_gc : PORT_ISC_FALLING_gc;
+    UNLOCKI();
+}
+
+void trigger_disarm(void) {
+    LOCKI();
+    TRIG_PINCTRL = PORT_ISC_INPUT_DISABLE_gc;
+    trigger.pending = false;
+    UNLOCKI();
+}
+
+bool trigger_pending(void) {
+    return trigger.pending;
+}
+
+void trigger_acknowledge(void) {
+    trigger.pending = false;
+}
+
+bool trigger_get_time(uint16_t *time) {
+    LOCKI();
+    *time = trigger.time;
+    bool fired = trigger.fired;
+    UNLOCKI();
+    return fired;
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if ENABLE_TRIGGER
+/**
+ * @brief Arm trigger input for a single edge.
+ *
+ * On the edge, the HX711 is powered up within the interrupt and the time
+ * of the edge is recorded. The time is read from the RTC, so it is exact
+ * only to one tick of 1/1024 s.
+ *
+ * @param rising Trigger on rising instead of falling edge
+ */
+void trigger_arm(bool rising);
+void trigger_disarm(void);
+/// Check whether trigger has fired and was not acknowledged yet.
+bool trigger_pending(void);
+void trigger_acknowledge(void);
+/**
+ * @brief Get time of last trigger.
+ *
+ * @param time Time of edge in RTC ticks of 1/1024s
+ * @return true iff trigger has fired since it was armed.
+ */
+bool trigger_get_time(uint16_t *time);
+#else
+static inline void trigger_arm(bool rising) {}
+static inline void trigger_disarm(void) {}
+static inline bool trigger_pending(void) {
+    return false;
+}
+static inline void trigger_acknowledge(void) {}
+static inline bool trigger_get_time(uint16_t *time) {
+    *time = 0;
+    return false;
+}
+#endif
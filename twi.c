@@ -3,13 +3,20 @@
     SPDX-License-Identifier: MIT
 */
 
+#define LOG_MODULE LOG_MOD_TWI
+
 #include "twi.h"
 
 #include "config.h"
 #include "debug.h"
+#include "hx711.h"
+#include "interlock.h"
 #include "nvm.h"
+#include "stepper.h"
 #include "timer.h"
+#include "trigger.h"
 #include "util.h"
+#include "valve.h"
 #include "version.h"
 
 #include <avr/interrupt.h>
@@ -38,8 +45,50 @@ struct {
     bool blocked;
     bool loaded;
     bool busy;
+    /// Loaded result is discarded after it has been read.
+    bool oneshot;
+    /// Master read is stretched until result is loaded.
+    bool stretching;
+    uint8_t read_mode;
+    /// Timeout for stretched reads in milliseconds.
+    uint8_t stretch_timeout;
+    uint8_t stretch_ticks;
+    /// Number of bytes received by paged write.
+    uint8_t blob_len;
+    /// Blob is locked for commit
+    bool blob_locked;
+    uint8_t blob[TWI_BLOB_SIZE];
 } twi = {.cmd = TWI_CMD_NONE, .task = TWI_CMD_NONE};
 
+/// State reported by queries answered within TWI interrupt.
+static struct {
+    /// Cached temperature in 1/16 degree Celsius.
+    int16_t temp;
+    /// Number of samples of current measurement.
+    uint16_t samples;
+    /// Number of commands received.
+    uint16_t commands;
+    /// Task currently processed by main loop.
+    uint8_t task;
+    /// Temperature was queried and should be updated.
+    bool temp_request;
+    /// Latency from address match to handling of command in microseconds,
+    /// when it woke the device from power down and when device was awake.
+    uint16_t wake_us;
+    uint16_t awake_us;
+    /// Latency measurement armed or running.
+    uint8_t latency;
+} twi_status = {.temp = TWI_TEMP_INVALID, .task = TWI_CMD_NONE};
+
+/// States of latency measurement.
+enum {
+    LATENCY_OFF,
+    LATENCY_ARMED_AWAKE,
+    LATENCY_ARMED_ASLEEP,
+    LATENCY_AWAKE,
+    LATENCY_ASLEEP,
+};
+
 #ifndef NDEBUG
 
 #define DBG_SIZE 16
@@ -60,33 +109,62 @@ static const __flash struct {
     uint8_t minor;
     uint8_t patch;
     uint16_t hash;
+    uint8_t api;
 } version_info = {
     .major = VERSION_MAJOR,
     .minor = VERSION_MINOR,
     .patch = GIT_DIRTY ? 0x80 | VERSION_PATCH : VERSION_PATCH,
     .hash = GIT_HASH,
+    .api = TWI_API_VERSION,
 };
 #pragma pack(pop)
 
 _Static_assert(sizeof(twi.buf) > sizeof(calib_data),
                "Two wire interface buffer is too small");
+_Static_assert(sizeof(twi.buf) >= 2 * STEPPER_DELAY_BINS,
+               "Two wire interface buffer is too small for delays");
 
 /// 4-bit lookup table for CRC-5-ITU with polynom 0x15, ref-in, ref-out
 static const __flash uint8_t crc_table[16] = {
     0x00, 0x0d, 0x1a, 0x17, 0x1f, 0x12, 0x05, 0x08,
     0x15, 0x18, 0x0f, 0x02, 0x0a, 0x07, 0x10, 0x1d};
 
+/// Calculate CRC-5-ITU after next byte.
+static inline uint8_t crc_update(uint8_t crc, uint8_t val) {
+    crc = crc_table[(crc ^ val) & 0x0f] ^ (crc >> 4);
+    return crc_table[(crc ^ (val >> 4)) & 0x0f] ^ (crc >> 4);
+}
+
 /// Update CRC-5-ITU for next byte.
 static inline void twi_update_crc(uint8_t val) {
-    uint8_t crc = twi.crc;
-    crc = crc_table[(crc ^ val) & 0x0f] ^ (crc >> 4);
-    twi.crc = crc_table[(crc ^ (val >> 4)) & 0x0f] ^ (crc >> 4);
+    twi.crc = crc_update(twi.crc, val);
 }
 
+#if ENABLE_BENCH
+uint8_t twi_bench_crc(uint8_t crc, uint8_t val) {
+    return crc_update(crc, val);
+}
+#endif
+
 static inline void prepare_recv(void) {
     switch (twi.cmd) {
     case TWI_CMD_SET_CALIB: twi.count = sizeof(calib_data); break;
-    case TWI_CMD_ROTATE: twi.count = 2; break;
+    case TWI_CMD_BLOB_PAGE: twi.count = TWI_BUFFER_SIZE; break;
+    case TWI_CMD_MOVE_TO: twi.count = 5; break;
+    case TWI_CMD_HOME: // fallthrough
+    case TWI_CMD_FEED: twi.count = 7; break;
+    case TWI_CMD_SET_POSITION: // fallthrough
+    case TWI_CMD_SET_MODULUS: twi.count = 4; break;
+    case TWI_CMD_ROTATE:        // fallthrough
+    case TWI_CMD_ARM_TRIGGER:   // fallthrough
+    case TWI_CMD_BENCHMARK:     // fallthrough
+    case TWI_CMD_SET_LOG:       // fallthrough
+    case TWI_CMD_SET_READ_MODE: // fallthrough
+    case TWI_CMD_BLOB_WRITE:    // fallthrough
+    case TWI_CMD_SET_KEEP_AWAKE: twi.count = 2; break;
+    case TWI_CMD_NOISE_TEST:  // fallthrough
+    case TWI_CMD_SELECT_TARE: // fallthrough
+    case TWI_CMD_BLOB_COMMIT: // fallthrough
     case TWI_CMD_CALIB_WRITE: // fallthrough
     case TWI_CMD_SET_ADDR:    // fallthrough
     case TWI_CMD_ADDR_WRITE:  // fallthrough
@@ -95,18 +173,162 @@ static inline void prepare_recv(void) {
     }
 }
 
+/// Load response of query answered within interrupt.
+static void load_response(uint8_t count) {
+    twi.task = TWI_CMD_NONE;
+    twi.count = count;
+    twi.loaded = true;
+}
+
+static uint8_t status_flags(void) {
+    uint8_t flags = 0;
+    if (valve_is_open()) {
+        flags |= TWI_STATUS_VALVE_OPEN;
+    }
+    if (stepper_is_running()) {
+        flags |= TWI_STATUS_STEPPER_RUNNING;
+    }
+    if (hx711_is_active()) {
+        flags |= TWI_STATUS_HX711_ACTIVE;
+    }
+    if ((WDT.CTRLA & WDT_PERIOD_gm) != 0) {
+        flags |= TWI_STATUS_WD_ENABLED;
+    }
+    switch (stepper_home_state()) {
+    case STEPPER_HOME_IDLE: break;
+    case STEPPER_HOME_DONE: flags |= TWI_STATUS_HOMED; break;
+    case STEPPER_HOME_FAILED: flags |= TWI_STATUS_HOME_FAILED; break;
+    default: flags |= TWI_STATUS_HOMING; break;
+    }
+    if (interlock_tripped()) {
+        flags |= TWI_STATUS_TRIPPED;
+    }
+    return flags;
+}
+
+static uint8_t recv_page(void) {
+    uint8_t offset = twi.buf[0];
+    twi.crc = 0;
+    for (uint8_t i = 0; i <= TWI_BLOB_PAGE; ++i) {
+        twi_update_crc(twi.buf[i]);
+    }
+    if ((twi.crc & 0x1f) != twi.buf[TWI_BLOB_PAGE + 1]) {
+        return TWI_BLOB_CRC_ERROR;
+    }
+    if (twi.blob_locked) {
+        return TWI_BLOB_BUSY;
+    }
+    if (offset == 0) {
+        // restart transfer
+        twi.blob_len = 0;
+    }
+    if (offset != twi.blob_len) {
+        return TWI_BLOB_OUT_OF_ORDER;
+    }
+    if (offset > TWI_BLOB_SIZE - TWI_BLOB_PAGE) {
+        return TWI_BLOB_OVERFLOW;
+    }
+    memcpy(twi.blob + offset, twi.buf + 1, TWI_BLOB_PAGE);
+    twi.blob_len += TWI_BLOB_PAGE;
+    return TWI_BLOB_OK;
+}
+
 static void finish_recv(void) {
     TWI0.SCTRLB = NACK;
     twi.state = IDLE;
+    ++twi_status.commands;
 
     switch (twi.cmd) {
     case TWI_CMD_GET_VERSION:
-        twi.task = TWI_CMD_NONE;
-        twi.count = sizeof(version_info);
         memcpy_P(twi.buf, (const __flash uint8_t *)&version_info,
                  sizeof(version_info));
+        load_response(sizeof(version_info));
+        break;
+    case TWI_CMD_GET_CALIB:
+        write_big_endian_u32(twi.buf, calib_data.hx711.offset);
+        write_big_endian_u16(twi.buf + 4, calib_data.hx711.scale);
+        load_response(sizeof(calib_data));
+        break;
+    case TWI_CMD_GET_TEMP:
+        write_big_endian_u16(twi.buf, twi_status.temp);
+        load_response(2);
+        twi_status.temp_request = true;
+        break;
+    case TWI_CMD_GET_STATUS:
+        twi.buf[0] = status_flags();
+        twi.buf[1] = twi_status.task;
+        write_big_endian_u16(twi.buf + 2, twi_status.samples);
+        write_big_endian_u16(twi.buf + 4, twi_status.commands);
+        twi.buf[6] = stepper_get_cycle();
+        twi.buf[7] = interlock_reason();
+        load_response(8);
+        break;
+    case TWI_CMD_GET_POSITION:
+        write_big_endian_u32(twi.buf, stepper_get_position());
+        twi.buf[4] = stepper_is_running();
+        load_response(5);
+        break;
+    case TWI_CMD_GET_TRIGGER: {
+        uint16_t time;
+        twi.buf[0] = trigger_get_time(&time);
+        write_big_endian_u16(twi.buf + 1, time);
+        load_response(3);
+        break;
+    }
+    case TWI_CMD_GET_LATENCY:
+        write_big_endian_u16(twi.buf, twi_status.wake_us);
+        write_big_endian_u16(twi.buf + 2, twi_status.awake_us);
+        load_response(4);
+        break;
+    case TWI_CMD_GET_TARE: {
+        uint8_t i = tare_index;
+        twi.buf[0] = i;
+        write_big_endian_u32(twi.buf + 1,
+                             i == NVM_TARE_NONE ? 0 : tare_table.tare[i]);
+        load_response(5);
+        break;
+    }
+    case TWI_CMD_GET_STEPPER_STATS: {
+        struct stepper_stats stats;
+        stepper_get_stats(&stats);
+        write_big_endian_u16(twi.buf, stats.latency_us);
+        twi.buf[2] = stats.awake;
+        write_big_endian_u16(twi.buf + 3, stats.max_delay);
+        write_big_endian_u16(twi.buf + 5, stats.late);
+        load_response(7);
+        break;
+    }
+    case TWI_CMD_GET_STEPPER_DELAYS: {
+        struct stepper_stats stats;
+        stepper_get_stats(&stats);
+        for (uint8_t i = 0; i < STEPPER_DELAY_BINS; ++i) {
+            write_big_endian_u16(twi.buf + 2 * i, stats.delays[i]);
+        }
+        load_response(2 * STEPPER_DELAY_BINS);
+        break;
+    }
+    case TWI_CMD_BLOB_PAGE:
+        twi.buf[0] = recv_page();
+        twi.buf[1] = twi.blob_len;
+        load_response(2);
+        break;
+    case TWI_CMD_SET_READ_MODE:
+        twi.task = TWI_CMD_NONE;
+        if (twi.buf[0] <= TWI_READ_FRESH_STRETCH) {
+            twi.read_mode = twi.buf[0];
+            twi.stretch_timeout = twi.buf[1];
+        }
+        break;
+#if ENABLE_LOG_RING
+    case TWI_CMD_GET_LOG:
+        // Log ring is drained when master reads.
+        twi.task = TWI_CMD_NONE;
+        twi.count = TWI_BUFFER_SIZE;
         twi.loaded = true;
         break;
+#endif
+    case TWI_CMD_BLOB_COMMIT:                      // fallthrough
+    case TWI_CMD_BLOB_WRITE: twi.blob_locked = true; // fallthrough
     case TWI_CMD_OPEN_VALVE:                       // fallthrough
     case TWI_CMD_CLOSE_VALVE:                      // fallthrough
     case TWI_CMD_ENABLE_WD:                        // fallthrough
@@ -114,6 +336,11 @@ static void finish_recv(void) {
     case TWI_CMD_SET_ADDR:                         // fallthrough
     case TWI_CMD_ADDR_WRITE:                       // fallthrough
     case TWI_CMD_SET_CALIB:                        // fallthrough
+    case TWI_CMD_SET_LOG:                          // fallthrough
+    case TWI_CMD_SELECT_TARE:                      // fallthrough
+    case TWI_CMD_SET_POSITION:                     // fallthrough
+    case TWI_CMD_SET_MODULUS:                      // fallthrough
+    case TWI_CMD_SET_KEEP_AWAKE:                   // fallthrough
     case TWI_CMD_CALIB_WRITE: twi.blocked = true;  // fallthrough
     default: twi.task = twi.cmd; break;
     }
@@ -129,10 +356,62 @@ static void prepare_send(void) {
             twi.count = 5;
         }
         break;
+#if ENABLE_LOG_RING
+    case TWI_CMD_GET_LOG:
+        debug_log_read(twi.buf, TWI_BUFFER_SIZE);
+        twi.count = TWI_BUFFER_SIZE;
+        break;
+#endif
     default: break;
     }
 }
 
+static void start_send(void) {
+    TWI0.SCTRLB = ACK;
+    prepare_send();
+    if (twi.oneshot) {
+        // Data stays in buffer for this read only.
+        twi.loaded = false;
+        twi.oneshot = false;
+    }
+    twi.state = STARTED;
+    twi.index = 0;
+    twi.crc = 0;
+    twi.busy = true;
+}
+
+static void start_stretch(void) {
+    // Leaving the address interrupt flag set holds SCL low.
+    // Disable address interrupt until result is loaded.
+    TWI0.SCTRLA &= ~TWI_APIEN_bm;
+    twi.stretching = true;
+    twi.stretch_ticks = twi.stretch_timeout;
+    twi.busy = true;
+    timer_tick_start();
+}
+
+static void end_stretch(bool ack) {
+    timer_tick_stop();
+    twi.stretching = false;
+    if (ack) {
+        start_send();
+    } else {
+        TWI0.SCTRLB = NACK;
+    }
+    TWI0.SCTRLA |= TWI_APIEN_bm;
+}
+
+ISR(RTC_PIT_vect) {
+    RTC.PITINTFLAGS = RTC_PI_bm;
+    if (!twi.stretching) {
+        timer_tick_stop();
+    } else if (twi.stretch_ticks == 0) {
+        end_stretch(false);
+    } else {
+        --twi.stretch_ticks;
+    }
+}
+
 ISR(TWI0_TWIS_vect) {
     uint8_t status = TWI0.SSTATUS;
     if ((status & TWI_APIF_bm) != 0) {
@@ -140,18 +419,24 @@ ISR(TWI0_TWIS_vect) {
             // Address
             if ((status & TWI_DIR_bm) != 0 && twi.loaded) {
                 // Master read
-                TWI0.SCTRLB = ACK;
-                prepare_send();
-                twi.state = STARTED;
-                twi.index = 0;
-                twi.crc = 0;
-                twi.busy = true;
+                start_send();
+            } else if ((status & TWI_DIR_bm) != 0 &&
+                       twi.read_mode == TWI_READ_FRESH_STRETCH) {
+                // Master read, but result is not yet loaded
+                start_stretch();
             } else if ((status & TWI_DIR_bm) == 0 && !twi.blocked) {
                 // Master write
                 TWI0.SCTRLB = ACK;
+                if (twi_status.latency != LATENCY_OFF &&
+                    twi_status.latency < LATENCY_AWAKE &&
+                    timer_cycles_start()) {
+                    // Armed states map to running states
+                    twi_status.latency += LATENCY_AWAKE - LATENCY_ARMED_AWAKE;
+                }
                 twi.state = STARTED;
                 twi.index = 0;
                 twi.loaded = false;
+                twi.oneshot = false;
                 twi.busy = true;
             } else {
                 TWI0.SCTRLB = NACK;
@@ -161,6 +446,12 @@ ISR(TWI0_TWIS_vect) {
             // Stop
             TWI0.SCTRLB = DONE;
             twi.state = IDLE;
+            if (twi_status.latency >= LATENCY_AWAKE &&
+                twi.task == TWI_CMD_NONE) {
+                // Command was answered within interrupt
+                timer_cycles_stop();
+                twi_status.latency = LATENCY_OFF;
+            }
         }
     } else if ((status & TWI_DIF_bm) != 0) {
         if ((status & TWI_DIR_bm) != 0) {
@@ -226,6 +517,9 @@ ISR(TWI0_TWIS_vect) {
 
 #ifndef NDEBUG
 void twi_dump_dbg(void) {
+    if (!LOG_ON(LOG_DEBUG)) {
+        return;
+    }
     LOGS("TWI:\n");
     for (uint8_t i = 0; i < twi_dbg.index; i++) {
         LOGHEX(twi_dbg.buf[i].status);
@@ -298,21 +592,59 @@ static bool twi_prepare_load(uint8_t count) {
     }
     twi.count = count;
     twi.loaded = true;
+    twi.oneshot = twi.read_mode != TWI_READ_REPEAT;
     return true;
 }
 
+static void twi_finish_load(void) {
+    if (twi.stretching && twi.loaded) {
+        // Answer stretched read right away
+        end_stretch(true);
+    }
+    sei();
+}
+
 void twi_write(uint8_t count, const uint8_t *data) {
     if (twi_prepare_load(count)) {
         memcpy(twi.buf, data, count);
     }
-    sei();
+    twi_finish_load();
 }
 
 void twi_write_P(uint8_t count, const __flash uint8_t *data) {
     if (twi_prepare_load(count)) {
         memcpy_P(twi.buf, data, count);
     }
-    sei();
+    twi_finish_load();
+}
+
+void twi_set_status(uint8_t task, uint16_t samples) {
+    LOCKI();
+    twi_status.task = task;
+    twi_status.samples = samples;
+    UNLOCKI();
+}
+
+void twi_set_temp(int16_t temp) {
+    LOCKI();
+    twi_status.temp = temp;
+    twi_status.temp_request = false;
+    UNLOCKI();
+}
+
+bool twi_temp_requested(void) {
+    return twi_status.temp_request;
+}
+
+/// Get data of paged write.
+/// Must only be called while processing a blocking command.
+const uint8_t *twi_get_blob(uint8_t *len) {
+    *len = twi.blob_len;
+    return twi.blob;
+}
+
+void twi_release_blob(void) {
+    twi.blob_locked = false;
 }
 
 void twi_read(struct twi_data *data) {
@@ -327,5 +659,38 @@ void twi_read(struct twi_data *data) {
         twi.task = TWI_CMD_NONE;
         twi.blocked = false;
     }
+    // Keep measuring while the transaction is in progress.
+    if (twi_status.latency >= LATENCY_AWAKE && data->task != TWI_CMD_NONE) {
+        uint16_t us = timer_cycles_to_us(timer_cycles_stop());
+        if (twi_status.latency == LATENCY_ASLEEP) {
+            twi_status.wake_us = us;
+        } else {
+            twi_status.awake_us = us;
+        }
+        twi_status.latency = LATENCY_OFF;
+    } else if (twi_status.latency < LATENCY_AWAKE) {
+        twi_status.latency = LATENCY_OFF;
+    }
     sei();
 }
+
+void twi_arm_latency(bool asleep) {
+    // A running measurement is only stopped by the transaction or twi_read().
+    if (twi_status.latency < LATENCY_AWAKE) {
+        twi_status.latency =
+            asleep ? LATENCY_ARMED_ASLEEP : LATENCY_ARMED_AWAKE;
+    }
+}
+
+void twi_disarm_latency(void) {
+    LOCKI();
+    if (twi_status.latency >= LATENCY_AWAKE && twi.state == IDLE &&
+        twi.task == TWI_CMD_NONE) {
+        // Transaction ended without Stop, release TCB0.
+        timer_cycles_stop();
+        twi_status.latency = LATENCY_OFF;
+    } else if (twi_status.latency < LATENCY_AWAKE) {
+        twi_status.latency = LATENCY_OFF;
+    }
+    UNLOCKI();
+}
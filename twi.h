@@ -9,6 +9,17 @@
 #include <stdint.h>
 
 #define TWI_BUFFER_SIZE 8
+/// Format of responses, last byte of TWI_CMD_GET_VERSION.
+/// 1: Span of TWI_CMD_MEASURE_WEIGHT holds span in the lower 4 bits and
+///    shift in the upper 4 bits, instead of 3 and 5 bits.
+#define TWI_API_VERSION 1
+/// Number of data bytes in page of TWI_CMD_BLOB_PAGE.
+/// The page starts with the offset and ends with CRC-5 of offset and data.
+#define TWI_BLOB_PAGE (TWI_BUFFER_SIZE - 2)
+/// Size of staging buffer for paged writes, a multiple of TWI_BLOB_PAGE.
+/// The blob is the little endian image of a region of nvm.h, unlike all
+/// other multi-byte values of the protocol, which are big endian.
+#define TWI_BLOB_SIZE (6 * TWI_BLOB_PAGE)
 
 /// Reset value of temperature.
 #define TWI_TEMP_INVALID (-128)
@@ -18,6 +29,73 @@
 #define TWI_CONFIRM_ADDR_WRITE 0x6A
 /// Confirmation byte for TWI_CMD_DISABLE_WD.
 #define TWI_CONFIRM_DISABLE_WD 0x9A
+/// Confirmation byte for TWI_CMD_BLOB_WRITE.
+#define TWI_CONFIRM_BLOB_WRITE 0xCA
+
+/// Result of TWI_CMD_BLOB_PAGE.
+enum {
+    TWI_BLOB_OK = 0,
+    TWI_BLOB_CRC_ERROR = 1,
+    /// Offset is neither zero nor end of previous page.
+    TWI_BLOB_OUT_OF_ORDER = 2,
+    TWI_BLOB_OVERFLOW = 3,
+    /// Previous blob is still being committed.
+    TWI_BLOB_BUSY = 4,
+};
+
+/// Flags of TWI_CMD_GET_STATUS response.
+enum {
+    TWI_STATUS_VALVE_OPEN = 0x01,
+    TWI_STATUS_STEPPER_RUNNING = 0x02,
+    TWI_STATUS_HX711_ACTIVE = 0x04,
+    TWI_STATUS_WD_ENABLED = 0x08,
+    /// Homing procedure in progress.
+    TWI_STATUS_HOMING = 0x10,
+    /// Last homing procedure succeeded.
+    TWI_STATUS_HOMED = 0x20,
+    /// Last homing procedure failed.
+    TWI_STATUS_HOME_FAILED = 0x40,
+    /// An interlock tripped, reason is in last byte of status.
+    TWI_STATUS_TRIPPED = 0x80,
+};
+
+/// Reasons of interlock trips.
+enum {
+    TWI_TRIP_NONE = 0,
+    TWI_TRIP_WEIGHT = 1,
+    TWI_TRIP_RATE = 2,
+    TWI_TRIP_RUNTIME = 3,
+};
+
+/// Flags of TWI_CMD_ARM_TRIGGER.
+enum {
+    TWI_TRIGGER_RISING = 0x01,
+};
+
+/// Kernels timed by TWI_CMD_BENCHMARK.
+enum {
+    /// Empty call, result is the remaining measurement error.
+    TWI_BENCH_NONE = 0,
+    TWI_BENCH_BUCKETS_ADD = 1,
+    TWI_BENCH_BUCKETS_FILTER = 2,
+    TWI_BENCH_WEIGHT = 3,
+    TWI_BENCH_STEPPER_PERIOD = 4,
+    TWI_BENCH_CRC = 5,
+    TWI_BENCH_COUNT,
+};
+
+/// Read modes selected with TWI_CMD_SET_READ_MODE, followed by the timeout
+/// of stretched reads in ms, which has a jitter of 1ms. Unknown modes are
+/// ignored.
+enum {
+    /// Reads return the last loaded result repeatedly.
+    TWI_READ_REPEAT = 0,
+    /// Each result is returned once, reads are NACKed until next result.
+    TWI_READ_FRESH_NACK = 1,
+    /// Each result is returned once, reads are stretched until next result
+    /// or until timeout.
+    TWI_READ_FRESH_STRETCH = 2,
+};
 
 /// TWI commands.
 enum {
@@ -26,16 +104,49 @@ enum {
     TWI_CMD_TRACK_WEIGHT = 0x51,
     TWI_CMD_OPEN_VALVE = 0x52,
     TWI_CMD_CLOSE_VALVE = 0x53,
+    /// Returns the temperature in 1/16 degree Celsius measured after the
+    /// previous GET_TEMP, or at reset for the first one, and then requests
+    /// a new measurement. Read twice to get a current value.
     TWI_CMD_GET_TEMP = 0x54,
     TWI_CMD_GET_CALIB = 0x55,
     TWI_CMD_SET_CALIB = 0x56,
     TWI_CMD_ENABLE_WD = 0x57,
     TWI_CMD_ROTATE = 0x58,
+    TWI_CMD_SET_LOG = 0x59,
+    TWI_CMD_SET_READ_MODE = 0x5A,
+    TWI_CMD_BLOB_PAGE = 0x5B,
+    TWI_CMD_BLOB_COMMIT = 0x5C,
+    TWI_CMD_MOVE_TO = 0x5D,
+    TWI_CMD_SET_POSITION = 0x5E,
+    TWI_CMD_SET_MODULUS = 0x5F,
+    TWI_CMD_HOME = 0x60,
+    TWI_CMD_SET_KEEP_AWAKE = 0x61,
+    TWI_CMD_FEED = 0x62,
+    TWI_CMD_CLEAR_TRIP = 0x63,
+    /// Starts the task in the first byte on the next edge of the trigger
+    /// input. The HX711 powers up within microseconds of the edge, but its
+    /// timestamp has the resolution of the RTC, 1/1024 s, as TCA0 and TCB0
+    /// are taken by stepper and valve.
+    TWI_CMD_ARM_TRIGGER = 0x64,
+    TWI_CMD_NOISE_TEST = 0x65,
+    TWI_CMD_BENCHMARK = 0x66,
+    TWI_CMD_SELECT_TARE = 0x67,
     TWI_CMD_CALIB_WRITE = 0xA0,
     TWI_CMD_SET_ADDR = 0xA3,
     TWI_CMD_ADDR_WRITE = 0xA6,
     TWI_CMD_DISABLE_WD = 0xA9,
+    TWI_CMD_BLOB_WRITE = 0xAC,
     TWI_CMD_GET_VERSION = 0xE0,
+    TWI_CMD_GET_LOG = 0xE1,
+    TWI_CMD_GET_STATUS = 0xE2,
+    TWI_CMD_GET_POSITION = 0xE3,
+    TWI_CMD_GET_STEPPER_STATS = 0xE4,
+    /// Returns whether the trigger fired and the time of the edge in RTC
+    /// ticks of 1/1024 s since TWI_CMD_ARM_TRIGGER.
+    TWI_CMD_GET_TRIGGER = 0xE5,
+    TWI_CMD_GET_LATENCY = 0xE6,
+    TWI_CMD_GET_TARE = 0xE7,
+    TWI_CMD_GET_STEPPER_DELAYS = 0xE8,
     TWI_CMD_NONE = 0xFF,
 };
 
@@ -53,6 +164,35 @@ void twi_write(uint8_t count, const uint8_t *data);
 void twi_write_P(uint8_t count, const __flash uint8_t *data);
 void twi_read(struct twi_data *data);
 uint8_t twi_get_send_count(void);
+void twi_set_status(uint8_t task, uint16_t samples);
+/// Store temperature returned by next TWI_CMD_GET_TEMP.
+void twi_set_temp(int16_t temp);
+/// TWI_CMD_GET_TEMP was answered and asks for a new measurement.
+bool twi_temp_requested(void);
+/**
+ * @brief Measure latency of next command from address match to twi_read().
+ *
+ * Must be called with interrupts disabled right before sleeping. The
+ * address match claims TCB0 as cycle counter, which is released by
+ * twi_read() or at the end of a transaction without task. Does nothing
+ * while a measurement is running.
+ *
+ * @param asleep Device sleeps in power down mode
+ */
+void twi_arm_latency(bool asleep);
+void twi_disarm_latency(void);
+/**
+ * @brief Get blob received by TWI_CMD_BLOB_PAGE.
+ *
+ * TWI_CMD_BLOB_COMMIT and TWI_CMD_BLOB_WRITE lock the blob against further
+ * pages until twi_release_blob().
+ */
+const uint8_t *twi_get_blob(uint8_t *len);
+void twi_release_blob(void);
+#if ENABLE_BENCH
+/// Benchmark hook, calculate CRC-5-ITU after next byte.
+uint8_t twi_bench_crc(uint8_t crc, uint8_t val);
+#endif
 
 #ifndef NDEBUG
 void twi_dump_dbg(void);
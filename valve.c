@@ -0,0 +1,126 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#include "valve.h"
+
+#include "config.h"
+#include "debug.h"
+#include "hx711.h"
+#include "nvm.h"
+#include "timer.h"
+#include "util.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+// Software PWM on TCB0, as the valve pin has no timer output.
+#define VALVE_PWM_HZ 2000UL
+// Timer ticks of a PWM period with CLKDIV2
+#define VALVE_PERIOD ((uint16_t)(F_CPU / 2 / VALVE_PWM_HZ))
+// Shortest pulse to leave time for the interrupt to return
+#define VALVE_MIN_TICKS 64
+// Longest wait for TCB0, the HX711 powerdown timer takes 60us
+#define VALVE_CLAIM_US 100
+
+static struct {
+    bool open;
+    volatile bool pulsing;
+    /// Remaining PWM periods of full drive
+    uint16_t pull_in;
+    uint16_t on_ticks;
+    uint16_t off_ticks;
+} valve;
+
+// TCB0 is shared, the interrupt is dispatched to its owner.
+ISR(TCB0_INT_vect) {
+    TCB0.INTFLAGS = TCB_CAPT_bm;
+    if (timer_tcb_owner() != TIMER_TCB_VALVE) {
+        hx711_powerdown_elapsed();
+        return;
+    }
+    if (valve.pull_in != 0) {
+        --valve.pull_in;
+        return;
+    }
+    if ((VALVE_PORT.OUT & VALVE_BIT) != 0) {
+        VALVE_PORT.OUTCLR = VALVE_BIT;
+        TCB0.CCMP = valve.off_ticks;
+    } else {
+        VALVE_PORT.OUTSET = VALVE_BIT;
+        TCB0.CCMP = valve.on_ticks;
+    }
+}
+
+void valve_init(void) {
+    // Set valve pin low
+    VALVE_PORT.OUTCLR = VALVE_BIT;
+    // Set valve pin as output
+    VALVE_PORT.DIRSET = VALVE_BIT;
+}
+
+void valve_open(void) {
+    if (valve.open) {
+        return;
+    }
+    valve.open = true;
+    VALVE_PORT.OUTSET = VALVE_BIT;
+
+    uint8_t duty = valve_config.hold_duty;
+    if (duty == 0xFF) {
+        return;
+    }
+    uint16_t on = (uint32_t)VALVE_PERIOD * duty / 256;
+    if (on < VALVE_MIN_TICKS) {
+        on = VALVE_MIN_TICKS;
+    } else if (on > VALVE_PERIOD - VALVE_MIN_TICKS) {
+        on = VALVE_PERIOD - VALVE_MIN_TICKS;
+    }
+    valve.on_ticks = on;
+    valve.off_ticks = VALVE_PERIOD - on;
+    uint32_t periods =
+        (uint32_t)valve_config.pull_in_ms * VALVE_PWM_HZ / 1000;
+    valve.pull_in = periods > 0xFFFF ? 0xFFFF : periods;
+
+    uint8_t wait = VALVE_CLAIM_US / 4;
+    while (!timer_tcb_claim(TIMER_TCB_VALVE)) {
+        if (wait-- == 0) {
+            // Keep full drive rather than blocking the caller.
+            if (LOG_ON(LOG_WARN)) {
+                LOGS("valve: busy\n");
+            }
+            return;
+        }
+        _delay_us(4);
+    }
+    cli();
+    valve.pulsing = true;
+    // Periodic interrupt mode
+    TCB0.CTRLB = TCB_CNTMODE_INT_gc;
+    TCB0.CNT = 0;
+    TCB0.CCMP = VALVE_PERIOD;
+    TCB0.INTFLAGS = TCB_CAPT_bm;
+    TCB0.INTCTRL = TCB_CAPT_bm;
+    TCB0.CTRLA = TCB_RUNSTDBY_bm | TCB_CLKSEL_CLKDIV2_gc | TCB_ENABLE_bm;
+    sei();
+}
+
+void valve_close(void) {
+    LOCKI();
+    if (valve.pulsing) {
+        timer_tcb_release(TIMER_TCB_VALVE);
+        valve.pulsing = false;
+    }
+    VALVE_PORT.OUTCLR = VALVE_BIT;
+    valve.open = false;
+    UNLOCKI();
+}
+
+bool valve_is_open(void) {
+    return valve.open;
+}
+
+bool valve_is_pulsing(void) {
+    return valve.pulsing;
+}
@@ -0,0 +1,21 @@
+/*
+    SPDX-FileCopyrightText: 2023 Mathias Fiedler
+    SPDX-License-Identifier: MIT
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+void valve_init(void);
+/**
+ * @brief Open valve with peak-and-hold drive.
+ *
+ * The valve is driven fully for the pull-in time of valve_config, then
+ * with the hold duty cycle. A hold duty of 255 keeps full drive.
+ */
+void valve_open(void);
+void valve_close(void);
+bool valve_is_open(void);
+/// Valve is driven by PWM and TCB0 is in use.
+bool valve_is_pulsing(void);